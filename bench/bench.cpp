@@ -0,0 +1,351 @@
+#include "bench_util.hpp"
+#include "color_distance.hpp"
+#include "dither.hpp"
+#include "image.hpp"
+#include "render.hpp"
+#include "renderer.hpp"
+#include "sixel.hpp"
+#include "terminal.hpp"
+#include "thread_pool.hpp"
+#include <memory>
+#include <random>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/**
+ *  Microbenchmarks and end-to-end render benchmarks. All the inputs are
+ *  generated from fixed seeds, and the terminal is constructed headless
+ *  with a fixed geometry and the default palette, so runs are comparable
+ *  across machines and do not need a tty.
+ *
+ *  Every result is printed as one JSON object per line.
+ */
+
+static const int term_width = 300;
+static const int term_height = 100;
+static const int font_width = 8;
+static const int font_height = 16;
+static const double min_time = 0.2;
+
+static const char* mode_name(Terminal::term_colors_t colors) {
+    switch (colors) {
+    case Terminal::ansi: return "ansi";
+    case Terminal::extended: return "extended";
+    case Terminal::truecolor: return "truecolor";
+    }
+    return "unknown";
+}
+
+/**
+ *  Run fn until at least min_time seconds passed, and return the average
+ *  time of a call in nanoseconds.
+ */
+template<typename F>
+static double time_ns(F fn) {
+    fn();
+    long long iters = 0;
+    double start = now();
+    double elapsed;
+    do {
+        fn();
+        iters++;
+        elapsed = now() - start;
+    } while (elapsed < min_time);
+    return elapsed * 1e9 / iters;
+}
+
+static std::unique_ptr<Terminal> make_terminal(Terminal::term_colors_t colors) {
+    return std::unique_ptr<Terminal>(new Terminal(
+        Terminal::xterm, colors, term_width, term_height, font_width, font_height
+    ));
+}
+
+static std::vector<char> random_pixels(size_t count, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::vector<char> data(3*count);
+    for (auto& c: data) c = rng();
+    return data;
+}
+
+static void bench_color_distance() {
+    auto data = random_pixels(1<<16, 1);
+    volatile double sink = 0;
+    double ns = time_ns([&]() {
+        double acc = 0;
+        for (size_t i=0; i+6<=data.size(); i+=6)
+            acc += color_distance(data[i], data[i+1], data[i+2], data[i+3], data[i+4], data[i+5], ycgco);
+        sink = acc;
+    });
+    (void)sink;
+    printf("{\"bench\": \"color_distance\", \"ns_per_call\": %.3f}\n", ns / (data.size()/6));
+}
+
+static void bench_approximate(Terminal::term_colors_t colors) {
+    const size_t count = 1<<16;
+    auto data = random_pixels(count, 2);
+    auto run = [&](Terminal& term) {
+        for (size_t i=0; i<data.size(); i+=3)
+            term.approximate(data[i], data[i+1], data[i+2]);
+    };
+    // Cold cache: every call on random colors is very likely a miss.
+    auto term = make_terminal(colors);
+    double start = now();
+    run(*term);
+    double cold = (now() - start) * 1e9 / count;
+    double warm = time_ns([&]() { run(*term); }) / count;
+    printf(
+        "{\"bench\": \"approximate\", \"mode\": \"%s\", \"cold_ns_per_pixel\": %.3f, \"warm_ns_per_pixel\": %.3f}\n",
+        mode_name(colors), cold, warm
+    );
+}
+
+/**
+ *  Construction of a terminal, which is dominated by building the palette
+ *  and its search structures.
+ */
+static void bench_palette(Terminal::term_colors_t colors, bool blend) {
+    double ns = time_ns([&]() {
+        Terminal term(
+            Terminal::xterm, colors, term_width, term_height, font_width, font_height, {}, ycgco, blend
+        );
+    });
+    printf(
+        "{\"bench\": \"palette\", \"mode\": \"%s\", \"blend\": %s, \"ms_per_terminal\": %.3f}\n",
+        mode_name(colors), blend ? "true" : "false", ns / 1e6
+    );
+}
+
+static void bench_cell_string(Terminal::term_colors_t colors) {
+    const size_t count = 1<<14;
+    auto data = random_pixels(count, 3);
+    auto term = make_terminal(colors);
+    std::vector<TermColor> cells;
+    for (size_t i=0; i<data.size(); i+=3)
+        cells.push_back(term->approximate(data[i], data[i+1], data[i+2]));
+    size_t bytes = 0;
+    double ns = time_ns([&]() {
+        bytes = 0;
+        for (auto& c: cells) bytes += c.cell_string().size();
+    });
+    printf(
+        "{\"bench\": \"cell_string\", \"mode\": \"%s\", \"ns_per_cell\": %.3f, \"bytes_per_cell\": %.3f}\n",
+        mode_name(colors), ns / count, double(bytes) / count
+    );
+}
+
+static void bench_downscale(const std::string& name, const Image& source) {
+    double ns = time_ns([&]() {
+        Image img = source;
+        img.downscale(term_width, term_height, font_width, font_height);
+    });
+    printf(
+        "{\"bench\": \"downscale\", \"image\": \"%s\", \"ns_per_pixel\": %.3f}\n",
+        name.c_str(), ns / (source.width * source.height)
+    );
+}
+
+static void bench_render(const std::string& name, const Image& source, Terminal::term_colors_t colors, ThreadPool& pool) {
+    auto term = make_terminal(colors);
+    size_t bytes = 0;
+    size_t cells = 0;
+    auto frame = [&]() {
+        Image img = source;
+        img.downscale(term->width, term->height, term->cwidth, term->cheight);
+        std::string out = render_image(*term, img, 0, 0, pool);
+        bytes = out.size();
+        cells = img.width * img.height;
+    };
+    double start = now();
+    frame();
+    double cold = now() - start;
+    double warm = time_ns(frame);
+    printf(
+        "{\"bench\": \"render\", \"image\": \"%s\", \"mode\": \"%s\", \"threads\": %u, "
+        "\"cold_ns_per_pixel\": %.3f, \"warm_ns_per_pixel\": %.3f, \"ns_per_cell\": %.3f, "
+        "\"ns_per_frame\": %.0f, \"bytes_per_frame\": %zu}\n",
+        name.c_str(), mode_name(colors), pool.size(),
+        cold * 1e9 / (source.width * source.height),
+        warm / (source.width * source.height),
+        warm / cells, warm, bytes
+    );
+}
+
+/**
+ *  Encoding of a downscaled image on one thread: the generic path, which
+ *  dispatches on the terminal and color type for every cell, against the
+ *  specialized kernel that render_rows selects once.
+ */
+static void bench_kernel(const std::string& name, const Image& source, Terminal::term_colors_t colors, bool blend) {
+    Terminal term(Terminal::xterm, colors, term_width, term_height, font_width, font_height, {}, ycgco, blend);
+    Image img = source;
+    img.downscale(term.width, term.height, term.cwidth, term.cheight);
+    std::string out;
+    // Warm up the approximation cache, so that both paths only hit it.
+    render_rows(term, img, 0, img.height, 0, 0, out);
+    double generic = time_ns([&]() {
+        out.clear();
+        for (unsigned y=0; y<img.height; y++) {
+            out += term.move_to(0, y);
+            for (unsigned x=0; x<img.width; x++)
+                out += term.approximate(img.r(x, y), img.g(x, y), img.b(x, y)).cell_string();
+            out += term.clear_color();
+        }
+    });
+    double specialized = time_ns([&]() {
+        out.clear();
+        render_rows(term, img, 0, img.height, 0, 0, out);
+    });
+    size_t cells = img.width * img.height;
+    printf(
+        "{\"bench\": \"kernel\", \"image\": \"%s\", \"mode\": \"%s\", \"blend\": %s, "
+        "\"generic_ns_per_cell\": %.3f, \"specialized_ns_per_cell\": %.3f, \"speedup\": %.2f}\n",
+        name.c_str(), mode_name(colors), blend ? "true" : "false",
+        generic / cells, specialized / cells, generic / specialized
+    );
+}
+
+/**
+ *  Dithering of a downscaled image, against rendering it, with a warm
+ *  approximation cache.
+ */
+static void bench_dither(const std::string& name, const Image& source, Terminal::term_colors_t colors, ThreadPool& pool) {
+    auto term = make_terminal(colors);
+    Image img = source;
+    img.downscale(term->width, term->height, term->cwidth, term->cheight);
+    render_image(*term, img, 0, 0, pool);
+    double render = time_ns([&]() { render_image(*term, img, 0, 0, pool); });
+    const std::pair<const char*, dither_t> methods[] = {
+        {"bayer", bayer_dither}, {"blue-noise", blue_noise_dither}, {"diffusion", diffusion_dither}
+    };
+    for (const auto& method: methods) {
+        Image dithered = img;
+        dither(dithered, *term, method.second, pool);
+        double ns = time_ns([&]() {
+            Image frame = img;
+            dither(frame, *term, method.second, pool);
+        });
+        printf(
+            "{\"bench\": \"dither\", \"image\": \"%s\", \"mode\": \"%s\", \"method\": \"%s\", "
+            "\"threads\": %u, \"ns_per_cell\": %.3f, \"render_ns_per_cell\": %.3f}\n",
+            name.c_str(), mode_name(colors), method.first, pool.size(),
+            ns / (img.width * img.height), render / (img.width * img.height)
+        );
+    }
+}
+
+/**
+ *  Sixel output at full pixel resolution, to compare with the cell
+ *  renderer: time and bytes per frame.
+ */
+static void bench_sixel(const std::string& name, const Image& source, ThreadPool& pool) {
+    Image img = source;
+    img.downscale(term_width*font_width, term_height*font_height, 1, 1);
+    size_t bytes = 0;
+    double quantize = time_ns([&]() { sixel_quantize(img, 256, pool); });
+    SixelPalette palette = sixel_quantize(img, 256, pool);
+    double encode = time_ns([&]() { bytes = sixel_encode(img, palette, pool).size(); });
+    size_t pixels = img.width * img.height;
+    printf(
+        "{\"bench\": \"sixel\", \"image\": \"%s\", \"threads\": %u, \"colors\": %zu, "
+        "\"quantize_ns_per_pixel\": %.3f, \"encode_ns_per_pixel\": %.3f, "
+        "\"ns_per_frame\": %.0f, \"bytes_per_frame\": %zu}\n",
+        name.c_str(), pool.size(), palette.colors.size(),
+        quantize / pixels, encode / pixels, quantize + encode, bytes
+    );
+}
+
+/**
+ *  A sequence of frames of a static scene with a moving square, as in a
+ *  surveillance video, fitted and drawn with and without the reuse of the
+ *  previous frame: time and bytes per frame.
+ */
+static void bench_temporal(const std::string& name, const Image& source, Terminal::term_colors_t colors, unsigned threads) {
+    const size_t frame_count = 16, side = std::max<size_t>(1, source.width/20);
+    std::vector<Image> frames;
+    for (size_t f=0; f<frame_count; f++) {
+        Image img = source;
+        size_t x0 = f*source.width/frame_count/2, y0 = f*source.height/frame_count/2;
+        for (size_t y=y0; y<std::min(source.height, y0+side); y++) {
+            for (size_t x=x0; x<std::min(source.width, x0+side); x++) {
+                img.data()[3*(y*img.width+x)] = (char)255;
+                img.data()[3*(y*img.width+x)+1] = 40;
+                img.data()[3*(y*img.width+x)+2] = 40;
+            }
+        }
+        frames.push_back(std::move(img));
+    }
+    int null_fd = open("/dev/null", O_WRONLY);
+    for (bool temporal: {false, true}) {
+        Renderer renderer(make_terminal(colors), threads);
+        renderer.temporal = temporal;
+        std::unique_ptr<Image> previous;
+        size_t bytes = 0;
+        double ns = time_ns([&]() {
+            bytes = 0;
+            for (const auto& frame: frames) {
+                Image img = frame;
+                renderer.fit(img, term_width, term_height);
+                bytes += renderer.stream(img, 1, 1, null_fd, "", "", nullptr, temporal ? previous.get() : nullptr);
+                previous.reset(new Image(std::move(img)));
+            }
+        });
+        printf(
+            "{\"bench\": \"temporal\", \"image\": \"%s\", \"mode\": \"%s\", \"temporal\": %s, "
+            "\"ns_per_frame\": %.0f, \"bytes_per_frame\": %zu}\n",
+            name.c_str(), mode_name(colors), temporal ? "true" : "false",
+            ns / frame_count, bytes / frame_count
+        );
+    }
+    close(null_fd);
+}
+
+int main(int argc, char** argv) {
+    std::vector<std::string> files;
+    unsigned threads = 1;
+    for (int i=1; i<argc; i++) {
+        if (strcmp(argv[i], "--threads") == 0 && i+1 < argc) {
+            threads = atoi(argv[++i]);
+        } else {
+            files.emplace_back(argv[i]);
+        }
+    }
+    const Terminal::term_colors_t modes[] = {Terminal::ansi, Terminal::extended, Terminal::truecolor};
+    ThreadPool pool(threads);
+
+    bench_color_distance();
+    for (auto colors: modes) bench_approximate(colors);
+    for (auto colors: modes) bench_cell_string(colors);
+    for (auto colors: {Terminal::ansi, Terminal::extended}) {
+        bench_palette(colors, false);
+        bench_palette(colors, true);
+    }
+
+    std::vector<std::pair<std::string, Image>> images;
+    images.emplace_back("synthetic-1920x1080", synthetic_image(1920, 1080));
+    for (const auto& file: files) {
+        try {
+            images.emplace_back(file, Image(file));
+        } catch (std::exception& e) {
+            fprintf(stderr, "%s\n", e.what());
+            return 1;
+        }
+    }
+    for (const auto& img: images) {
+        bench_downscale(img.first, img.second);
+        for (auto colors: modes)
+            bench_render(img.first, img.second, colors, pool);
+        for (auto colors: modes) {
+            bench_kernel(img.first, img.second, colors, true);
+            if (colors != Terminal::truecolor)
+                bench_kernel(img.first, img.second, colors, false);
+        }
+        for (auto colors: {Terminal::ansi, Terminal::extended})
+            bench_dither(img.first, img.second, colors, pool);
+        bench_sixel(img.first, img.second, pool);
+        for (auto colors: modes)
+            bench_temporal(img.first, img.second, colors, threads);
+    }
+}
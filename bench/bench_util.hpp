@@ -0,0 +1,39 @@
+#ifndef TV_BENCH_UTIL_HPP
+#define TV_BENCH_UTIL_HPP
+#include "image.hpp"
+#include <chrono>
+#include <random>
+#include <vector>
+
+/**
+ *  Helpers shared by the benchmark and the evaluation programs.
+ */
+
+/**
+ *  Current time in seconds, from the steady clock.
+ */
+inline double now() {
+    auto t = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration<double>(t).count();
+}
+
+/**
+ *  Smooth gradient with some noise, roughly like a photograph. The noise
+ *  comes from a fixed seed, so the image is the same on every run.
+ */
+inline Image synthetic_image(size_t w, size_t h) {
+    std::mt19937 rng(42);
+    std::vector<char> data;
+    data.reserve(3*w*h);
+    for (size_t y=0; y<h; y++) {
+        for (size_t x=0; x<w; x++) {
+            int noise = rng() % 16;
+            data.push_back((255*x/w + noise) & 0xff);
+            data.push_back((255*y/h + noise) & 0xff);
+            data.push_back((255*(x+y)/(w+h) + noise) & 0xff);
+        }
+    }
+    return Image(w, h, std::move(data));
+}
+
+#endif
@@ -0,0 +1,156 @@
+#include "bench_util.hpp"
+#include "dither.hpp"
+#include "image.hpp"
+#include "render.hpp"
+#include "simulator.hpp"
+#include "terminal.hpp"
+#include "thread_pool.hpp"
+#include <memory>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+/**
+ *  Quality-vs-speed evaluation. Every image is rendered with each color
+ *  mode, with and without blending, on a headless terminal with the
+ *  default palette. The output is fed to a TerminalSimulator and the
+ *  displayed cells are compared with the downscaled image.
+ *
+ *  One JSON object is printed per image and configuration, followed by
+ *  one summary line per configuration with the averages over all the
+ *  images. A configuration is on the Pareto front when no other one for
+ *  the same terminal color capability is both faster and better (by
+ *  PSNR): a terminal can only choose among the modes it supports.
+ */
+
+static const int term_width = 300;
+static const int term_height = 100;
+static const int font_width = 8;
+static const int font_height = 16;
+static const int warm_runs = 3;
+
+struct Config {
+    const char* name;
+    Terminal::term_colors_t colors;
+    bool blend;
+    dither_t dither;
+};
+
+static const Config configs[] = {
+    {"ansi", Terminal::ansi, false, no_dither},
+    {"ansi+bayer", Terminal::ansi, false, bayer_dither},
+    {"ansi+blue-noise", Terminal::ansi, false, blue_noise_dither},
+    {"ansi+diffusion", Terminal::ansi, false, diffusion_dither},
+    {"ansi+blend", Terminal::ansi, true, no_dither},
+    {"ansi+blend+diffusion", Terminal::ansi, true, diffusion_dither},
+    {"extended", Terminal::extended, false, no_dither},
+    {"extended+diffusion", Terminal::extended, false, diffusion_dither},
+    {"extended+blend", Terminal::extended, true, no_dither},
+    {"truecolor", Terminal::truecolor, false, no_dither},
+};
+
+struct Summary {
+    double ns_per_pixel = 0;
+    double bytes_per_frame = 0;
+    double psnr = 0;
+    double smooth_psnr = 0;
+    double delta_e = 0;
+};
+
+static Summary evaluate(const std::string& name, const Image& source, const Config& config, ThreadPool& pool) {
+    Terminal term(
+        Terminal::xterm, config.colors, term_width, term_height, font_width, font_height,
+        {}, ycgco, config.blend
+    );
+    // The quality is measured against the downscaled image before
+    // dithering.
+    Image reference = source;
+    reference.downscale(term.width, term.height, term.cwidth, term.cheight);
+    // Cursor positions are 1-based: the image starts at the top left cell.
+    std::string out;
+    double start = now();
+    Image img = reference;
+    dither(img, term, config.dither, pool);
+    out = render_image(term, img, 1, 1, pool);
+    double cold = now() - start;
+    start = now();
+    for (int i=0; i<warm_runs; i++) {
+        Image frame = source;
+        frame.downscale(term.width, term.height, term.cwidth, term.cheight);
+        dither(frame, term, config.dither, pool);
+        out = render_image(term, frame, 1, 1, pool);
+    }
+    double warm = (now() - start) / warm_runs;
+
+    TerminalSimulator sim(term.width, term.height, Terminal::default_colors(Terminal::xterm, 256));
+    sim.feed(out);
+    Quality q = compare_quality(reference, sim, 0, 0);
+
+    Summary s;
+    s.ns_per_pixel = warm * 1e9 / (source.width * source.height);
+    s.bytes_per_frame = out.size();
+    s.psnr = q.psnr;
+    s.smooth_psnr = q.smooth_psnr;
+    s.delta_e = q.delta_e;
+    printf(
+        "{\"eval\": \"image\", \"image\": \"%s\", \"config\": \"%s\", \"threads\": %u, "
+        "\"cold_ns_per_pixel\": %.3f, \"warm_ns_per_pixel\": %.3f, \"bytes_per_frame\": %zu, "
+        "\"psnr\": %.3f, \"smooth_psnr\": %.3f, \"delta_e\": %.3f, \"max_delta_e\": %.3f}\n",
+        name.c_str(), config.name, pool.size(),
+        cold * 1e9 / (source.width * source.height), s.ns_per_pixel, out.size(),
+        q.psnr, q.smooth_psnr, q.delta_e, q.max_delta_e
+    );
+    return s;
+}
+
+int main(int argc, char** argv) {
+    std::vector<std::string> files;
+    unsigned threads = 1;
+    for (int i=1; i<argc; i++) {
+        if (strcmp(argv[i], "--threads") == 0 && i+1 < argc) {
+            threads = atoi(argv[++i]);
+        } else {
+            files.emplace_back(argv[i]);
+        }
+    }
+    ThreadPool pool(threads);
+
+    std::vector<std::pair<std::string, Image>> images;
+    images.emplace_back("synthetic-1920x1080", synthetic_image(1920, 1080));
+    for (const auto& file: files) {
+        try {
+            images.emplace_back(file, Image(file));
+        } catch (std::exception& e) {
+            fprintf(stderr, "%s\n", e.what());
+            return 1;
+        }
+    }
+
+    const size_t config_count = sizeof(configs) / sizeof(configs[0]);
+    std::vector<Summary> totals(config_count);
+    for (const auto& img: images) {
+        for (size_t c=0; c<config_count; c++) {
+            Summary s = evaluate(img.first, img.second, configs[c], pool);
+            totals[c].ns_per_pixel += s.ns_per_pixel / images.size();
+            totals[c].bytes_per_frame += s.bytes_per_frame / images.size();
+            totals[c].psnr += s.psnr / images.size();
+            totals[c].smooth_psnr += s.smooth_psnr / images.size();
+            totals[c].delta_e += s.delta_e / images.size();
+        }
+    }
+    for (size_t c=0; c<config_count; c++) {
+        bool dominated = false;
+        for (size_t o=0; o<config_count; o++) {
+            if (o == c || configs[o].colors != configs[c].colors) continue;
+            bool no_worse = totals[o].ns_per_pixel <= totals[c].ns_per_pixel && totals[o].psnr >= totals[c].psnr;
+            bool better = totals[o].ns_per_pixel < totals[c].ns_per_pixel || totals[o].psnr > totals[c].psnr;
+            if (no_worse && better) dominated = true;
+        }
+        printf(
+            "{\"eval\": \"summary\", \"config\": \"%s\", \"images\": %zu, \"ns_per_pixel\": %.3f, "
+            "\"bytes_per_frame\": %.0f, \"psnr\": %.3f, \"smooth_psnr\": %.3f, \"delta_e\": %.3f, \"pareto\": %s}\n",
+            configs[c].name, images.size(), totals[c].ns_per_pixel, totals[c].bytes_per_frame,
+            totals[c].psnr, totals[c].smooth_psnr, totals[c].delta_e, dominated ? "false" : "true"
+        );
+    }
+}
@@ -0,0 +1,81 @@
+#ifndef TV_ADAPTIVE_HPP
+#define TV_ADAPTIVE_HPP
+#include "terminal.hpp"
+#include <string>
+#include <vector>
+
+/**
+ *  Rendering settings chosen for a frame by the adaptive mode.
+ *
+ *  colors, blend: palette of the terminal used to render the frame.
+ *  scale: each pixel of the image covers scale x scale cells.
+ *  predicted_bytes: expected size of the frame.
+ */
+struct AdaptiveChoice {
+    Terminal::term_colors_t colors;
+    bool blend;
+    int scale;
+    double predicted_bytes;
+
+    /**
+     *  Name of the color mode, such as "extended+blend".
+     */
+    std::string mode_name() const;
+};
+
+class AdaptiveController {
+    /**
+     *  Target time, in seconds, to transfer a frame to the terminal.
+     */
+    double budget;
+
+    /**
+     *  Estimated terminal throughput in bytes per second, 0 if unknown.
+     */
+    double rate = 0;
+
+    /**
+     *  Color modes that can be used, from best to worst, with their
+     *  estimated size in bytes of the escape sequences of a cell. The
+     *  estimates start from typical values and follow the sizes of the
+     *  rendered frames.
+     */
+    struct Mode {
+        Terminal::term_colors_t colors;
+        bool blend;
+        double escape_bytes;
+    };
+    std::vector<Mode> modes;
+public:
+    /**
+     *  Largest pixel size that may be chosen.
+     */
+    static const int max_scale = 4;
+
+    /**
+     *  Use the color modes up to max_colors, trying to transfer frames in
+     *  budget seconds.
+     */
+    AdaptiveController(Terminal::term_colors_t max_colors, double budget);
+
+    /**
+     *  Choose the settings for a frame covering the given number of cells:
+     *  the best color mode at the highest resolution whose predicted
+     *  transfer time fits the budget, degrading the colors first and then
+     *  the resolution. With no measurement yet, the best settings are used.
+     */
+    AdaptiveChoice choose(int cols, int rows) const;
+
+    /**
+     *  Record a rendered frame: its size, the number of cells it covered,
+     *  and the time the terminal took to consume it.
+     */
+    void record(const AdaptiveChoice& choice, size_t bytes, size_t cells, double seconds);
+
+    /**
+     *  Estimated throughput of the terminal, in bytes per second.
+     */
+    double drain_rate() const { return rate; }
+};
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef TV_BATCH_HPP
+#define TV_BATCH_HPP
+#include "dither.hpp"
+#include "stats.hpp"
+#include "terminal.hpp"
+#include "thread_pool.hpp"
+#include <string>
+#include <vector>
+
+/**
+ *  Render each of the given image files to <out_dir>/<name>.ans, where
+ *  name is the file name without directory and extension. The output
+ *  contains no cursor movements, so it can be printed with cat.
+ *
+ *  Files are spread among the threads of the pool, which all share the
+ *  palette and approximation cache of term. Each image is dithered with
+ *  method by the thread that renders it. If stats is not null, one frame
+ *  is added to it per file, in the given order.
+ *
+ *  Files whose output path is the same as the one of a previous file are
+ *  reported and not rendered. Returns the number of files that could not
+ *  be rendered.
+ */
+size_t render_batch(
+    Terminal& term, const std::vector<std::string>& files,
+    const std::string& out_dir, ThreadPool& pool, Stats* stats = nullptr,
+    dither_t method = no_dither
+);
+
+#endif
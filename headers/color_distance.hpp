@@ -5,6 +5,34 @@ enum dist_algo_t {
     ycgco
 };
 
+/**
+ *  Distance between two colors with the metric fixed at compile time, so
+ *  that it can be inlined in the approximation loops.
+ */
+template<dist_algo_t algo>
+double color_distance(
+    unsigned char r1, unsigned char g1, unsigned char b1,
+    unsigned char r2, unsigned char g2, unsigned char b2
+);
+
+template<>
+inline double color_distance<ycgco>(
+    unsigned char r1, unsigned char g1, unsigned char b1,
+    unsigned char r2, unsigned char g2, unsigned char b2
+) {
+    int y1 = r1 + 2*g1 + 2*b1, cg1 = -r1 + 2*g1 - b1, co1 = 2*r1 - 2*b1;
+    int y2 = r2 + 2*g2 + 2*b2, cg2 = -r2 + 2*g2 - b2, co2 = 2*r2 - 2*b2;
+    double y_diff = y1 - y2;
+    double cg_diff = cg1 - cg2;
+    double co_diff = co1 - co2;
+    // Chroma differences weigh more if either color is close to gray.
+    double mult = co1*co1 + cg1*cg1 < 100 || co2*co2 + cg2*cg2 < 100 ? 4 : 1;
+    return y_diff*y_diff + mult*(cg_diff*cg_diff + co_diff*co_diff);
+}
+
+/**
+ *  Distance between two colors with the given metric.
+ */
 double color_distance(
     unsigned char r1, unsigned char g1, unsigned char b1,
     unsigned char r2, unsigned char g2, unsigned char b2,
@@ -0,0 +1,86 @@
+#ifndef TV_DAEMON_HPP
+#define TV_DAEMON_HPP
+#include "dither.hpp"
+#include "terminal.hpp"
+#include <array>
+#include <string>
+#include <vector>
+
+/**
+ *  Render request sent by a client to the daemon.
+ *
+ *  image: path of the image, absolute or relative to the daemon.
+ *  type, colors, blend, palette: terminal configuration. Requests with the
+ *  same configuration share a Terminal, with its palette and its cache.
+ *  width, height, cwidth, cheight: geometry of the client terminal.
+ *  dither: dithering applied to the image after downscaling.
+ */
+struct DaemonRequest {
+    std::string image;
+    Terminal::term_type_t type = Terminal::xterm;
+    Terminal::term_colors_t colors = Terminal::ansi;
+    bool blend = true;
+    int width = 0, height = 0;
+    int cwidth = 0, cheight = 0;
+    std::vector<std::array<unsigned char, 3>> palette;
+    dither_t dither = no_dither;
+
+    /**
+     *  Identifies the terminal configuration, regardless of the image and
+     *  geometry.
+     */
+    std::string fingerprint() const;
+
+    /**
+     *  Text encoding of the request, one "key value" pair per line.
+     *  parse throws std::runtime_error on malformed requests.
+     */
+    std::string serialize() const;
+    static DaemonRequest parse(const std::string& msg);
+};
+
+/**
+ *  Result of a request: the number of bytes written to the terminal and the
+ *  time spent in each stage on the daemon side, or an error message.
+ */
+struct DaemonReply {
+    bool ok = false;
+    std::string error;
+    size_t bytes = 0;
+    double decode = 0, downscale = 0, dither = 0, render = 0;
+};
+
+/**
+ *  Serve render requests on a Unix socket at path, until killed. An
+ *  existing socket at path is replaced. Connections from other users are
+ *  closed right away (SO_PEERCRED).
+ *
+ *  Requests are sequenced packets, each carrying the file descriptor of the
+ *  client terminal (SCM_RIGHTS), which the daemon writes the frame to
+ *  directly. Each connection is served by its own thread, and a frame
+ *  stops as soon as its client closes the connection. Up to max_terminals terminal configurations are kept warm;
+ *  the least recently used one is dropped beyond that.
+ *
+ *  Throws std::system_error if the socket cannot be set up.
+ */
+void run_daemon(const std::string& path, unsigned threads, size_t max_terminals = 8);
+
+/**
+ *  Connection to a daemon. Every call to render sends one request with the
+ *  given terminal file descriptor, and waits for the frame to be written.
+ */
+class DaemonClient {
+    int sock;
+public:
+    /**
+     *  Throws std::system_error if the daemon is not reachable.
+     */
+    DaemonClient(const std::string& path);
+    ~DaemonClient();
+    DaemonClient(const DaemonClient&) = delete;
+    DaemonClient& operator=(const DaemonClient&) = delete;
+
+    DaemonReply render(const DaemonRequest& request, int fd);
+};
+
+#endif
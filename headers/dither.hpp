@@ -0,0 +1,31 @@
+#ifndef TV_DITHER_HPP
+#define TV_DITHER_HPP
+#include "image.hpp"
+#include "terminal.hpp"
+#include "thread_pool.hpp"
+
+/**
+ *  Dithering methods.
+ *
+ *  no_dither: every cell is approximated independently.
+ *  bayer_dither: ordered dithering with an 8x8 Bayer matrix.
+ *  blue_noise_dither: ordered dithering with a 32x32 blue noise threshold
+ *                     map, which has no visible repeating pattern.
+ *  diffusion_dither: Floyd-Steinberg error diffusion with the colors of the
+ *                    terminal palette.
+ */
+enum dither_t {no_dither, bayer_dither, blue_noise_dither, diffusion_dither};
+
+/**
+ *  Dither an image downscaled to one pixel per cell, before it is rendered
+ *  with term. The result is still an RGB image: each pixel is moved so
+ *  that the approximations of the renderer spread the error over
+ *  neighbouring cells. Truecolor terminals are left untouched.
+ *
+ *  Ordered methods process the rows fully in parallel. Error diffusion
+ *  processes them as a wavefront: each row trails the previous one by two
+ *  pixels, so all the threads of the pool work at once.
+ */
+void dither(Image& img, Terminal& term, dither_t method, ThreadPool& pool);
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef TV_EVENT_LOOP_HPP
+#define TV_EVENT_LOOP_HPP
+#include "stats.hpp"
+#include <signal.h>
+#include <stddef.h>
+#include <termios.h>
+#include <functional>
+#include <string>
+
+/**
+ *  Event loop built on epoll. The events are the expiration of a deadline
+ *  (a timerfd), keys pressed on the terminal, termination signals (a
+ *  signalfd) and notifications from other threads (an eventfd). Waiting
+ *  for events does not use any CPU.
+ */
+class EventLoop {
+    int epoll_fd = -1;
+    int timer_fd = -1;
+    int signal_fd = -1;
+    int event_fd = -1;
+
+    /**
+     *  Terminal that keys are read from, or -1, and its settings before
+     *  they were changed to read single keys without echo.
+     */
+    int tty_fd = -1;
+    struct termios initial_term;
+
+    /**
+     *  Signal mask before the termination signals were blocked, and
+     *  actions of SIGINT, SIGTERM and SIGHUP before the handler used by
+     *  interruptible was installed.
+     */
+    sigset_t initial_mask;
+    struct sigaction initial_actions[3];
+
+    /**
+     *  Bytes read from the terminal that were not returned as keys yet.
+     */
+    std::string keys;
+
+    /**
+     *  Restore the terminal and the signal mask, and close the descriptors.
+     */
+    void release();
+public:
+    /**
+     *  Events returned by wait.
+     *
+     *  deadline: the deadline given to set_deadline was reached.
+     *  next, previous, pause: keys to move in the slideshow or to pause it.
+     *  quit: the q key, or SIGINT, SIGTERM or SIGHUP.
+     *  notified: notify was called.
+     */
+    enum event_t {deadline, next, previous, pause, quit, notified};
+
+    /**
+     *  Create the loop. The termination signals are blocked, so that they
+     *  are only received by the loop: it must be created before starting
+     *  any thread, as the threads inherit the signal mask. If keyboard is
+     *  true and stdin is a terminal, keys are read from it.
+     */
+    explicit EventLoop(bool keyboard);
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+    ~EventLoop();
+
+    /**
+     *  Make wait return deadline at the given time, or immediately if it
+     *  passed already. Replaces the previous deadline.
+     */
+    void set_deadline(Stats::clock::time_point when);
+    void clear_deadline();
+
+    /**
+     *  Make wait return notified. Can be called from any thread.
+     */
+    void notify();
+
+    /**
+     *  Block until the next event. Unknown keys are ignored.
+     */
+    event_t wait();
+
+    /**
+     *  Unblock the termination signals on the calling thread, or block
+     *  them again. While they are unblocked, they are not returned by
+     *  wait: they restore the terminal and end the process right away,
+     *  for work that cannot wait for the loop, such as drawing a frame.
+     */
+    void interruptible(bool enable);
+};
+
+/**
+ *  Show count slides, in order, each interval seconds after the previous
+ *  one was presented, then return interval seconds after the last one.
+ *
+ *  prepare(i) is called on a background thread, while the previous slide
+ *  is on screen, and present(i, miss, deadline) on the calling thread as
+ *  soon as both prepare(i) completed and the slide is due. miss is the
+ *  time by which the preparation missed the deadline of the slide, or 0.
+ *  deadline points to that deadline, or is null if the slide was not
+ *  shown by the timer, for present functions that do work of their own
+ *  before the slide appears and measure the miss themselves. The two
+ *  functions are never called concurrently, and present(i) always
+ *  follows prepare(i) without other calls in between.
+ *
+ *  The keys of the loop move to the next or previous slide immediately,
+ *  pause and resume the slideshow, or quit. Termination signals that come
+ *  during present end the process, after restoring the terminal. Exceptions
+ *  thrown by either function stop the slideshow and are rethrown.
+ */
+void run_slideshow(
+    EventLoop& loop, size_t count, double interval,
+    const std::function<void(size_t)>& prepare,
+    const std::function<void(size_t, double, const Stats::clock::time_point*)>& present
+);
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef TV_FRAMEBUFFER_HPP
+#define TV_FRAMEBUFFER_HPP
+#include "image.hpp"
+#include "thread_pool.hpp"
+#include <string>
+
+/**
+ *  Geometry and pixel format of a framebuffer, as reported by the
+ *  FBIOGET_VSCREENINFO and FBIOGET_FSCREENINFO ioctls.
+ *
+ *  width, height: visible resolution, in pixels.
+ *  xoffset, yoffset: position of the visible area in the virtual one.
+ *  bits_per_pixel: size of a pixel, 16, 24 or 32.
+ *  line_length: size of a line, in bytes.
+ *  red, green, blue: position of the lowest bit and number of bits of
+ *                    each channel, in a pixel read in host byte order.
+ */
+struct FramebufferInfo {
+    unsigned width = 0, height = 0;
+    unsigned xoffset = 0, yoffset = 0;
+    unsigned bits_per_pixel = 32;
+    unsigned line_length = 0;
+    struct Channel {
+        unsigned offset, length;
+    };
+    Channel red{16, 8}, green{8, 8}, blue{0, 8};
+
+    /**
+     *  The common 32-bit XRGB layout, without padding, for the given size.
+     */
+    static FramebufferInfo xrgb8888(unsigned width, unsigned height);
+};
+
+/**
+ *  A memory mapped framebuffer.
+ */
+class Framebuffer {
+    int fd;
+    char* mem;
+    size_t size;
+    FramebufferInfo fb_info;
+    void map(const std::string& path);
+public:
+    /**
+     *  Open a framebuffer device, such as /dev/fb0, and get its format
+     *  from the device. Throws std::runtime_error on failure, or if the
+     *  pixel format is not supported.
+     */
+    Framebuffer(const std::string& device);
+
+    /**
+     *  Use any file, such as a regular file standing in for a device, as a
+     *  framebuffer with the given format. The file is extended to the size
+     *  of the framebuffer if it is smaller.
+     */
+    Framebuffer(const std::string& path, const FramebufferInfo& info);
+
+    ~Framebuffer();
+    Framebuffer(const Framebuffer&) = delete;
+    Framebuffer& operator=(const Framebuffer&) = delete;
+
+    const FramebufferInfo& info() const { return fb_info; }
+
+    /**
+     *  Draw img with its top left corner at pixel (x, y) of the visible
+     *  area, clipped to it. Each row is converted to the pixel format in a
+     *  buffer and copied to the framebuffer at once; rows are split among
+     *  the threads of the pool.
+     *
+     *  Returns the number of bytes written.
+     */
+    size_t draw(const Image& img, int x, int y, ThreadPool& pool);
+};
+
+#endif
@@ -20,12 +20,23 @@ public:
      */
     Image(const std::string& file);
 
+    /**
+     *  Constructor - use the given 3*width*height RGB values
+     */
+    Image(size_t width, size_t height, std::vector<char> data);
+
     /**
      *  Functions to access the r/g/b components of a pixel in position x, y
      */
-    inline unsigned char r(int x, int y) {return img[y*3*width+3*x];}
-    inline unsigned char g(int x, int y) {return img[y*3*width+3*x+1];}
-    inline unsigned char b(int x, int y) {return img[y*3*width+3*x+2];}
+    inline unsigned char r(int x, int y) const {return img[y*3*width+3*x];}
+    inline unsigned char g(int x, int y) const {return img[y*3*width+3*x+1];}
+    inline unsigned char b(int x, int y) const {return img[y*3*width+3*x+2];}
+
+    /**
+     *  Raw RGB values, row by row.
+     */
+    inline const char* data() const {return img.data();}
+    inline char* data() {return img.data();}
 
     /**
      *  Function to downscale the image to a new resolution.
@@ -34,6 +45,37 @@ public:
      *  of the new pixels in terms of the old ones.
      */
     void downscale(size_t w, size_t h, size_t pixel_width, size_t pixel_height);
+
+    /**
+     *  Returns the result of downscale for a frame of a sequence, without
+     *  changing this image, so that it can be kept for the next frame.
+     *  previous_source is the previous frame, and previous the result of
+     *  the same downscale of it. The new pixels are computed in tiles of
+     *  tile x tile: the tiles whose old pixels are the same in
+     *  previous_source are copied from previous instead. If the sizes do
+     *  not match, every tile is computed. If changed is not null, it
+     *  receives one flag per tile, row by row, which is true if the tile
+     *  was computed.
+     */
+    Image downscaled(
+        size_t w, size_t h, size_t pixel_width, size_t pixel_height,
+        const Image& previous_source, const Image& previous,
+        size_t tile, std::vector<bool>* changed = nullptr
+    ) const;
+
+    /**
+     *  Returns a quick preview of the result of downscale, with the same
+     *  size. Each block x block group of new pixels takes the color of the
+     *  single old pixel at its center, so the cost does not depend on the
+     *  size of the original image.
+     */
+    Image sampled(size_t w, size_t h, size_t pixel_width, size_t pixel_height, size_t block) const;
+
+    /**
+     *  Function to enlarge the image by an integer factor, by repeating
+     *  each pixel factor times in both directions.
+     */
+    void upscale(size_t factor);
 };
 
 #endif
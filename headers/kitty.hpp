@@ -0,0 +1,69 @@
+#ifndef TV_KITTY_HPP
+#define TV_KITTY_HPP
+#include "image.hpp"
+#include <string>
+
+/**
+ *  Ways of transmitting the pixel data with the kitty graphics protocol.
+ *
+ *  shared_memory: POSIX shared memory object (t=s). The terminal unlinks it.
+ *  temp_file: temporary file (t=t). The terminal deletes it.
+ *  direct: base64 pixel data in the escape sequences themselves, in chunks.
+ *          It is the only one that works when the terminal runs on a
+ *          different machine.
+ */
+enum kitty_medium_t {kitty_shared_memory, kitty_temp_file, kitty_direct};
+
+/**
+ *  Returns the base64 encoding of the given data.
+ */
+std::string base64_encode(const char* data, size_t size);
+
+/**
+ *  Returns the escape sequences that draw img over cols x rows cells,
+ *  starting at the cursor position. For shared_memory and temp_file, name
+ *  is the shared memory object or file that already holds the pixels;
+ *  it is ignored for direct.
+ *
+ *  The output only depends on the arguments, so it can be compared with
+ *  captured output without a terminal.
+ */
+std::string kitty_command(
+    const Image& img, int cols, int rows,
+    kitty_medium_t medium, const std::string& name = ""
+);
+
+/**
+ *  Store the pixels of img in a new shared memory object or temporary
+ *  file, and return its name. Throws std::runtime_error on failure.
+ */
+std::string kitty_store_shared_memory(const Image& img);
+std::string kitty_store_temp_file(const Image& img);
+
+/**
+ *  Shared memory object or temporary file holding pixels for the terminal,
+ *  or nothing with direct.
+ */
+struct KittyObject {
+    kitty_medium_t medium = kitty_direct;
+    std::string name;
+};
+
+/**
+ *  Remove an object that the terminal may not have consumed. Objects that
+ *  were already removed are ignored.
+ */
+void kitty_release(const KittyObject& object);
+
+/**
+ *  Returns the escape sequences that draw img with the preferred medium,
+ *  falling back to temp_file and then direct if the pixels cannot be
+ *  stored. If stored is not null, it receives the object that holds the
+ *  pixels, to be released once the terminal has read the escape sequences.
+ */
+std::string kitty_image(
+    const Image& img, int cols, int rows, kitty_medium_t preferred,
+    KittyObject* stored = nullptr
+);
+
+#endif
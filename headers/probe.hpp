@@ -0,0 +1,66 @@
+#ifndef TV_PROBE_HPP
+#define TV_PROBE_HPP
+#include "kitty.hpp"
+#include "terminal.hpp"
+#include <array>
+#include <string>
+#include <vector>
+
+/**
+ *  Terminal information obtained by probing it or from a palette file.
+ *
+ *  width, height: size of the terminal in cells, 0 if unknown.
+ *  cwidth, cheight: size of a cell in pixels, 0 if unknown.
+ *  colors: RGB values of the first colors of the terminal.
+ */
+struct TermInfo {
+    int width = 0, height = 0;
+    int cwidth = 0, cheight = 0;
+    std::vector<std::array<unsigned char, 3>> colors;
+};
+
+/**
+ *  Probe the controlling terminal.
+ *
+ *  The size comes from the TIOCGWINSZ ioctl. On the console, the cell size
+ *  comes from the font and colors are fixed. On xterms, all the queries
+ *  (OSC 4 for the sixteen colors if query_colors is set, CSI 14t and 16t
+ *  for the window and cell size, and DA1 last, as a sentinel) are sent at
+ *  once, and the replies are parsed as they arrive, until the DA1 reply
+ *  comes or timeout seconds pass. Whatever did not arrive is replaced by
+ *  defaults, so this only throws if there is no terminal at all.
+ *
+ *  Complete replies are cached per terminal identity (TERM, WINDOWID,
+ *  KITTY_WINDOW_ID and tty name) in the user cache directory, and reused
+ *  by later calls unless use_cache is false.
+ */
+TermInfo probe_terminal(
+    Terminal::term_type_t type, bool query_colors,
+    bool use_cache = true, double timeout = 0.25
+);
+
+/**
+ *  Returns the size of the controlling terminal, in cells and pixels,
+ *  without sending any query to it.
+ */
+TermInfo terminal_size();
+
+/**
+ *  Read and write palette files. Each line holds a color as #rrggbb, in
+ *  order starting from color 0, or the cell size as "cell WxH". Empty lines
+ *  and lines starting with ';' are ignored. read_palette_file throws
+ *  std::runtime_error on errors.
+ */
+TermInfo read_palette_file(const std::string& path);
+bool write_palette_file(const std::string& path, const TermInfo& info);
+
+/**
+ *  Ask the controlling terminal which kitty graphics media it can load,
+ *  by storing a single pixel with each one, from preferred onwards, and
+ *  querying it with a=q. Returns the first one that the terminal could
+ *  load, or direct if none could, as with a remote terminal or one that
+ *  does not reply within timeout seconds.
+ */
+kitty_medium_t probe_kitty_medium(kitty_medium_t preferred, double timeout = 0.25);
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef TV_RENDER_HPP
+#define TV_RENDER_HPP
+#include "image.hpp"
+#include "stats.hpp"
+#include "terminal.hpp"
+#include "thread_pool.hpp"
+#include <string>
+
+/**
+ *  Placement of the rows: absolute_rows moves the cursor to the start of
+ *  each row, inline_rows just ends each row with a newline, so that the
+ *  output can be saved to a file and printed anywhere.
+ */
+enum row_layout_t {absolute_rows, inline_rows};
+
+/**
+ *  Options of the cell renderer.
+ *
+ *  layout: placement of the rows.
+ *  compact: only print the escape sequences of a cell if they differ from
+ *           the ones of the previous cell of the row.
+ *  cancel_fd: when streaming, stop writing the frame as soon as this file
+ *           descriptor becomes readable or hangs up (see StreamWriter).
+ */
+struct RenderOptions {
+    row_layout_t layout = absolute_rows;
+    bool compact = false;
+    int cancel_fd = -1;
+};
+
+/**
+ *  Append to out the escape sequences that draw rows [begin, end) of an
+ *  image that was already downscaled to one pixel per cell. The top-left
+ *  pixel of the image is drawn in position (start_col, start_row).
+ *  If stats is not null, approximation and encoding times, cells and cache
+ *  counters are added to it.
+ */
+void render_rows(
+    Terminal& term, const Image& img,
+    unsigned begin, unsigned end,
+    int start_col, int start_row,
+    std::string& out, FrameStats* stats = nullptr,
+    const RenderOptions& options = RenderOptions()
+);
+
+/**
+ *  Returns the escape sequences that draw the whole image. Rows are split
+ *  among the threads of the pool, each encoding into its own buffer, and
+ *  the buffers are then concatenated in order. If stats is not null, the
+ *  render timings and cache counters are added to it.
+ */
+std::string render_image(
+    Terminal& term, const Image& img,
+    int start_col, int start_row,
+    ThreadPool& pool, FrameStats* stats = nullptr,
+    const RenderOptions& options = RenderOptions()
+);
+
+/**
+ *  Like render_image, but each row is written to fd as soon as it and all
+ *  the previous ones are encoded, by a separate writer thread, so that
+ *  writing overlaps with the computation of the following rows. prefix
+ *  and suffix are written before and after the image. If stats is not
+ *  null, write holds the time until the last byte was written, measured
+ *  from the start of rendering.
+ *
+ *  Returns the number of bytes written.
+ */
+size_t stream_image(
+    Terminal& term, const Image& img,
+    int start_col, int start_row,
+    ThreadPool& pool, int fd,
+    const std::string& prefix, const std::string& suffix,
+    FrameStats* stats = nullptr,
+    const RenderOptions& options = RenderOptions()
+);
+
+/**
+ *  Like stream_image, but only draws the cells that are drawn differently
+ *  from the ones of previous, an image of the same size that is already
+ *  on screen at the same position, such as a preview from Image::sampled
+ *  or the previous frame of a sequence. Only the cells whose color differs
+ *  in the two images are approximated.
+ *  Runs of changed cells are placed with absolute cursor movements,
+ *  whatever the layout option. Throws std::invalid_argument if the sizes
+ *  of the images differ.
+ *
+ *  Returns the number of bytes written.
+ */
+size_t stream_changes(
+    Terminal& term, const Image& img, const Image& previous,
+    int start_col, int start_row,
+    ThreadPool& pool, int fd,
+    const std::string& prefix, const std::string& suffix,
+    FrameStats* stats = nullptr,
+    const RenderOptions& options = RenderOptions()
+);
+
+#endif
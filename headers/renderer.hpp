@@ -0,0 +1,117 @@
+#ifndef TV_RENDERER_HPP
+#define TV_RENDERER_HPP
+#include "dither.hpp"
+#include "image.hpp"
+#include "render.hpp"
+#include "stats.hpp"
+#include "terminal.hpp"
+#include "thread_pool.hpp"
+#include <stddef.h>
+#include <memory>
+#include <mutex>
+#include <string>
+
+/**
+ *  Entry point for programs that embed terminal-view, through
+ *  build/libterminal-view.a or build/libterminal-view.so.
+ *
+ *  A renderer owns a terminal, with its palette and approximation cache,
+ *  and a thread pool, which are built once and reused by every render.
+ *  Renderers share no state, and the functions of one renderer can be
+ *  called from several threads: the calls are serialized.
+ */
+class Renderer {
+    std::unique_ptr<Terminal> term;
+    ThreadPool workers;
+    std::mutex mutex;
+
+    /**
+     *  Last image given to fit with temporal set, before and after
+     *  downscaling, and the number of cells it was fitted in.
+     */
+    std::unique_ptr<Image> last_source, last_cells;
+    int last_cols = 0, last_rows = 0;
+
+    /**
+     *  Downscale and dither, with the mutex held.
+     */
+    void fit_locked(Image& img, int cols, int rows, FrameStats* stats);
+public:
+    /**
+     *  Dithering applied to the images after downscaling, and encoding
+     *  options. With the inline_rows layout, the position of the image
+     *  is ignored.
+     */
+    dither_t dither_method = no_dither;
+    RenderOptions options;
+
+    /**
+     *  If true, fit keeps the last image, and only downscales again the
+     *  tiles of tile_size x tile_size cells whose source pixels changed
+     *  in the next one. This is meant for sequences of frames of the same
+     *  size, such as videos, together with the previous argument of stream.
+     */
+    bool temporal = false;
+    static const size_t tile_size = 8;
+
+    /**
+     *  Create a renderer for the terminal of this process, whose size and
+     *  palette are probed.
+     */
+    Renderer(
+        Terminal::term_type_t type, Terminal::term_colors_t colors,
+        dist_algo_t algo = ycgco, bool blend = true,
+        bool use_probe_cache = true, unsigned threads = 0
+    );
+
+    /**
+     *  Create a renderer for the given terminal, which may have been built
+     *  with an explicit geometry and palette, without any I/O.
+     */
+    Renderer(std::unique_ptr<Terminal> term, unsigned threads = 0);
+    Renderer(const Renderer&) = delete;
+    Renderer& operator=(const Renderer&) = delete;
+
+    Terminal& terminal() { return *term; }
+    ThreadPool& pool() { return workers; }
+
+    /**
+     *  Downscale img to one pixel per cell, to fit in cols x rows cells,
+     *  and dither it. If stats is not null, the downscale and dither
+     *  times, and the reused tiles, are added to it.
+     */
+    void fit(Image& img, int cols, int rows, FrameStats* stats = nullptr);
+
+    /**
+     *  Render an image given as rows of width RGB triplets, stride bytes
+     *  apart, into the rectangle of cols x rows cells whose top-left cell
+     *  is (col, row), 1-based. The image is scaled to fit and centered in
+     *  the rectangle; nothing is drawn outside of it, even for images with
+     *  fewer pixels than the rectangle has cells.
+     *
+     *  Returns the size of the escape sequences that draw the image. They
+     *  are copied to out only if they fit in capacity bytes: otherwise,
+     *  nothing is written and the call can be repeated with a larger
+     *  buffer. If stats is not null, the timings are added to it.
+     */
+    size_t render(
+        const unsigned char* rgb, size_t width, size_t height, size_t stride,
+        int col, int row, int cols, int rows,
+        char* out, size_t capacity, FrameStats* stats = nullptr
+    );
+
+    /**
+     *  Write an image returned by fit to fd with stream_image, at the
+     *  given position, between prefix and suffix. If previous is not null,
+     *  it is the image already on screen at the same position, and only
+     *  the cells that changed are drawn, with stream_changes. Returns the
+     *  number of bytes written.
+     */
+    size_t stream(
+        const Image& img, int col, int row, int fd,
+        const std::string& prefix, const std::string& suffix,
+        FrameStats* stats = nullptr, const Image* previous = nullptr
+    );
+};
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef TV_SIMULATOR_HPP
+#define TV_SIMULATOR_HPP
+#include "image.hpp"
+#include <array>
+#include <string>
+#include <vector>
+
+/**
+ *  Reconstructs what a terminal displays from the escape sequences that
+ *  the renderer produces.
+ *
+ *  It understands cursor movements (CSI H), screen clears (CSI 2J), and
+ *  the colors set by SGR sequences: ANSI colors (30-37, 40-47, bold),
+ *  extended colors (38;5 and 48;5) and truecolor (38;2 and 48;2). The
+ *  color of a cell is the one perceived from its glyph: the blocks of
+ *  cell_string blend the foreground and background colors like
+ *  TermColor::blend does.
+ */
+class TerminalSimulator {
+    /**
+     *  RGB values of the terminal colors.
+     */
+    std::vector<std::array<unsigned char, 3>> palette;
+
+    /**
+     *  Displayed color of each cell, row by row.
+     */
+    std::vector<std::array<unsigned char, 3>> cells;
+
+    /**
+     *  Cursor position (0-based) and current colors. ANSI foreground
+     *  colors are kept as palette indices, as bold changes them.
+     */
+    int x = 0, y = 0;
+    std::array<unsigned char, 3> fg, bg;
+    int fg_ansi = -1;
+    bool bold = false;
+
+    /**
+     *  Bytes of an incomplete sequence at the end of the last feed.
+     */
+    std::string pending;
+
+    void reset_colors();
+    void apply_sgr(const std::vector<int>& params);
+    void put_glyph(int quarters);
+    std::array<unsigned char, 3> foreground() const;
+public:
+    /**
+     *  Size of the screen, in cells.
+     */
+    int width, height;
+
+    /**
+     *  Create a simulated terminal with the given colors (16 or 256).
+     *  The screen starts black.
+     */
+    TerminalSimulator(int width, int height, const std::vector<std::array<unsigned char, 3>>& palette);
+
+    /**
+     *  Process terminal output. Sequences may be split between calls.
+     */
+    void feed(const std::string& data);
+
+    /**
+     *  Displayed color of a cell.
+     */
+    const std::array<unsigned char, 3>& cell(int x, int y) const {
+        return cells[y*width+x];
+    }
+};
+
+/**
+ *  Quality of a displayed image with respect to a reference image.
+ *
+ *  psnr: peak signal to noise ratio over the RGB values, in dB.
+ *  delta_e: average CIE76 color difference in the L*a*b* space.
+ *  max_delta_e: largest CIE76 color difference of a cell.
+ *  smooth_psnr: PSNR after averaging both images over 3x3 cells, which
+ *               is closer to what is seen from a distance and rewards
+ *               dithering.
+ */
+struct Quality {
+    double psnr;
+    double delta_e;
+    double max_delta_e;
+    double smooth_psnr;
+};
+
+/**
+ *  Compare an image downscaled to one pixel per cell with the cells of
+ *  the simulated terminal, starting at (start_col, start_row).
+ */
+Quality compare_quality(const Image& reference, const TerminalSimulator& sim, int start_col, int start_row);
+
+#endif
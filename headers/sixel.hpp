@@ -0,0 +1,40 @@
+#ifndef TV_SIXEL_HPP
+#define TV_SIXEL_HPP
+#include "image.hpp"
+#include "thread_pool.hpp"
+#include <array>
+#include <string>
+#include <vector>
+
+/**
+ *  Adaptive palette for an image.
+ *
+ *  colors: RGB values of the palette colors, at most 256.
+ *  lut: palette index for every color with 5 bits per channel, indexed by
+ *       (r>>3)<<10 | (g>>3)<<5 | (b>>3).
+ */
+struct SixelPalette {
+    std::vector<std::array<unsigned char, 3>> colors;
+    std::vector<unsigned char> lut;
+};
+
+/**
+ *  Compute a palette of at most max_colors colors for img, with median cut
+ *  over a histogram of 5-bit-per-channel colors. The histogram is built in
+ *  parallel on the pool.
+ */
+SixelPalette sixel_quantize(const Image& img, unsigned max_colors, ThreadPool& pool);
+
+/**
+ *  Returns the sixel sequence that draws img with the given palette at
+ *  the cursor position. Bands of six rows are encoded in parallel on the
+ *  pool, with run-length encoding.
+ */
+std::string sixel_encode(const Image& img, const SixelPalette& palette, ThreadPool& pool);
+
+/**
+ *  Quantize and encode img.
+ */
+std::string sixel_image(const Image& img, unsigned max_colors, ThreadPool& pool);
+
+#endif
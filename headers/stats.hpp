@@ -0,0 +1,112 @@
+#ifndef TV_STATS_HPP
+#define TV_STATS_HPP
+#include <chrono>
+#include <string>
+#include <vector>
+
+/**
+ *  Timings and counters for the rendering of one image.
+ *
+ *  Times are in seconds, measured with a monotonic clock. approximate and
+ *  encode are summed over all the render threads; the others are wall
+ *  clock times.
+ */
+struct FrameStats {
+    std::string file;
+    double decode = 0;
+    double downscale = 0;
+    double dither = 0;
+    double approximate = 0;
+    double encode = 0;
+    double render = 0;
+    double write = 0;
+
+    /**
+     *  Time from the start of rendering to the start and to the end of
+     *  the first write of image rows to the terminal, when output is
+     *  streamed.
+     */
+    double first_write_start = 0;
+    double first_write = 0;
+
+    /**
+     *  Approximation cache lookups, and candidates that were compared
+     *  with the color in cache misses.
+     */
+    unsigned long long cache_hits = 0;
+    unsigned long long cache_misses = 0;
+    unsigned long long candidates = 0;
+
+    /**
+     *  Number of cells that were approximated, and of bytes written to the
+     *  terminal.
+     */
+    unsigned long long cells = 0;
+    unsigned long long bytes = 0;
+
+    /**
+     *  Tiles of cells of the image, and the ones that were downscaled
+     *  again because their source pixels changed since the previous frame.
+     *  tiles is 0 if the previous frame is not reused.
+     */
+    unsigned long long tiles = 0;
+    unsigned long long changed_tiles = 0;
+
+    /**
+     *  Settings chosen by the adaptive mode (color mode, cells per pixel in
+     *  each direction), and the terminal throughput in bytes per second
+     *  estimated after the frame. mode is empty if the adaptive mode is off.
+     */
+    std::string mode;
+    int scale = 1;
+    double drain_rate = 0;
+
+    /**
+     *  Time by which the preparation of the frame (decoding, downscaling
+     *  and dithering) missed the deadline when the frame should have been
+     *  presented, or 0 if it was ready in time. With a daemon, which
+     *  prepares and draws the frame in one go, it is the time by which
+     *  the frame was drawn after the deadline.
+     */
+    double deadline_miss = 0;
+};
+
+class Stats {
+public:
+    typedef std::chrono::steady_clock clock;
+
+    /**
+     *  Seconds elapsed since the given time.
+     */
+    static double since(clock::time_point start) {
+        return std::chrono::duration<double>(clock::now() - start).count();
+    }
+
+    /**
+     *  Startup times: terminal probing and palette construction.
+     */
+    double probe_time = 0;
+    double palette_time = 0;
+
+    /**
+     *  Number of render threads.
+     */
+    unsigned threads = 1;
+
+    /**
+     *  Number of frames that were not ready at their deadline.
+     */
+    unsigned deadline_misses = 0;
+
+    /**
+     *  Per-image statistics, in display order.
+     */
+    std::vector<FrameStats> frames;
+
+    /**
+     *  Returns the statistics as a JSON object.
+     */
+    std::string to_json() const;
+};
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef TV_STREAM_WRITER_HPP
+#define TV_STREAM_WRITER_HPP
+#include "stats.hpp"
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class StreamWriter {
+    /**
+     *  Output file descriptor, and a descriptor that stops the writes when
+     *  it becomes readable or hangs up, or -1.
+     */
+    int fd;
+    int cancel_fd;
+
+    /**
+     *  Chunks to write, in order, and whether they were submitted yet.
+     *  Chunks are written as soon as all the previous ones are.
+     */
+    std::vector<std::string> chunks;
+    std::vector<bool> ready;
+    size_t next_chunk = 0;
+
+    /**
+     *  Error code of the first failed write, or 0.
+     */
+    int error = 0;
+
+    /**
+     *  Start time, times when the write of timed_chunk started and ended,
+     *  and time when the last chunk was written.
+     */
+    Stats::clock::time_point start;
+    size_t timed_chunk;
+    double first_write_start = 0;
+    double first_write = 0;
+    double last_write = 0;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::thread writer;
+
+    /**
+     *  Main loop of the writer thread: collect all the consecutive chunks
+     *  that are ready, and write them with a single writev call.
+     */
+    void write_loop();
+
+    /**
+     *  Wait until fd can be written. Returns false if cancel_fd became
+     *  readable or hung up first.
+     */
+    bool wait_writable();
+public:
+    /**
+     *  Start a writer thread that will write chunk_count chunks to fd.
+     *  The time of the write that contains timed_chunk is recorded as the
+     *  first write, so that a header chunk can be left out of it.
+     *  If cancel_fd is not -1, writing fails with ECANCELED as soon as it
+     *  becomes readable or hangs up, such as the socket of a client that
+     *  went away; fd should be non-blocking then, so that a full output
+     *  does not delay that.
+     */
+    StreamWriter(int fd, size_t chunk_count, size_t timed_chunk = 0, int cancel_fd = -1);
+    StreamWriter(const StreamWriter&) = delete;
+    StreamWriter& operator=(const StreamWriter&) = delete;
+    ~StreamWriter();
+
+    /**
+     *  Give the contents of a chunk. Can be called from any thread, and
+     *  in any order.
+     */
+    void submit(size_t chunk, std::string data);
+
+    /**
+     *  Wait for all the chunks to be written. Throws std::system_error if
+     *  writing failed.
+     */
+    void wait();
+
+    /**
+     *  Seconds between construction and the start and end of the write
+     *  of timed_chunk, and the end of the last write. Valid after wait().
+     */
+    double first_write_start_time() const { return first_write_start; }
+    double first_write_time() const { return first_write; }
+    double last_write_time() const { return last_write; }
+};
+
+#endif
@@ -1,5 +1,6 @@
 #ifndef TV_TERM_COLOR_HPP
 #define TV_TERM_COLOR_HPP
+#include <string>
 #include <tuple>
 
 class TermColor {
@@ -80,6 +81,19 @@ public:
      */
     std::string cell_string();
 
+    /**
+     *  Character printed by cell_string, without the escape sequences that
+     *  set its colors.
+     */
+    const char* glyph() const;
+
+    /**
+     *  Returns true if the other color is printed exactly like this one,
+     *  so that the escape sequences of cell_string can be omitted when it
+     *  follows this color.
+     */
+    bool same_cell(const TermColor& other) const;
+
     /**
      *  Returns true if this color can be used as a background in a blending.
      */
@@ -2,17 +2,28 @@
 #define TV_TERMINAL_HPP
 #include "term_color.hpp"
 #include "color_distance.hpp"
+#include "stats.hpp"
+#include <array>
+#include <atomic>
+#include <memory>
+#include <stdlib.h>
 #include <vector>
 #include <map>
 
 class Terminal {
     /**
-     *  Ask the terminal the RGB values of a range of colors.
-     *  On xterms, use the \033]4;<color_id>;?\007 escape sequence for the
-     *  first sixteen colors. The next are fixed, so they are hardcoded.
-     *  On console, all colors are fixed, so they are hardcoded.
+     *  Complete the given terminal colors with the default ones, up to the
+     *  number the palette needs (16 for ansi, 256 for extended).
      */
-    std::vector<std::array<unsigned char, 3>> get_colors_rgb(int start, int end);
+    std::vector<std::array<unsigned char, 3>> expand_colors(
+        const std::vector<std::array<unsigned char, 3>>& cols
+    );
+
+    /**
+     *  Build the color palette, the buckets and the approximation cache from
+     *  the RGB values of the terminal colors.
+     */
+    void init_palette(const std::vector<std::array<unsigned char, 3>>& cols);
 
     /**
      *  Color palette for non-truecolor terminals.
@@ -26,14 +37,55 @@ class Terminal {
     unsigned bucket_width;
 
     /**
-     *  Array of cached approximations of colors with the palette.
+     *  Array of cached approximations of colors with the palette. Each entry
+     *  holds the palette index plus one, or 0 if not computed yet.
+     *  Entries are filled with relaxed atomic stores, so that approximate can
+     *  be called concurrently: any value written by any thread is valid.
+     *  The array is allocated with calloc, so that its 64MB are zeroed
+     *  lazily by the kernel as they are first touched, instead of in the
+     *  constructor.
      */
-    std::vector<int> approx_cache;
+    struct FreeDeleter {
+        void operator()(void* p) const { free(p); }
+    };
+    std::unique_ptr<std::atomic<int>[], FreeDeleter> approx_cache;
 
     /**
      *  Approximation algorithm used for rgb -> palette conversion.
      */
     dist_algo_t algo;
+
+    /**
+     *  Whether the palette includes blends of pairs of colors.
+     */
+    bool blend;
+
+    /**
+     *  How colors are approximated with the palette.
+     *
+     *  search: nearest palette color among the ones in nearby buckets,
+     *          cached in approx_cache.
+     *  xterm256: nearest color in the standard 6x6x6 color cube and gray
+     *            ramp of 256-color terminals, among the levels around each
+     *            channel. No cache is needed.
+     *  console16: scan of the sixteen fixed console colors. No cache is
+     *             needed.
+     */
+    enum approx_mode_t {search, xterm256, console16};
+    approx_mode_t approx_mode = search;
+
+    /**
+     *  Closed form approximations for the xterm256 and console16 modes,
+     *  and search of the nearest palette color on cache misses, which
+     *  counts the miss and its candidates in stats if it is not null.
+     *  Instantiated in terminal.cpp for every metric.
+     */
+    template<dist_algo_t A>
+    TermColor approximate_xterm256(unsigned char r, unsigned char g, unsigned char b);
+    template<dist_algo_t A>
+    TermColor approximate_console16(unsigned char r, unsigned char g, unsigned char b);
+    template<dist_algo_t A>
+    TermColor approximate_miss(unsigned char r, unsigned char g, unsigned char b, FrameStats* stats);
 public:
     /**
      *  Width and height of the terminal.
@@ -59,11 +111,83 @@ public:
     enum term_colors_t {ansi, extended, truecolor};
     term_colors_t colors;
 
+    /**
+     *  Time spent, in seconds, probing the terminal and building the
+     *  palette in the constructor.
+     */
+    double probe_time = 0;
+    double palette_time = 0;
+
     /**
      *  Initialize the terminal info (size, font size, color palette,
-     *  approximation algorithm).
+     *  approximation algorithm). If blend is false, the palette only has
+     *  the terminal colors, without blended glyphs; with the standard
+     *  palettes, this allows to approximate colors without a cache.
+     *  Probe results are cached per terminal unless use_probe_cache is false.
+     */
+    Terminal(
+        term_type_t type, term_colors_t colors, dist_algo_t algo = ycgco,
+        bool blend = true, bool use_probe_cache = true
+    );
+
+    /**
+     *  Initialize the terminal info from the given values, without
+     *  accessing any tty. palette holds the RGB values of the terminal
+     *  colors (16 for ansi, 256 for extended); missing colors are replaced
+     *  by the default ones for the terminal type.
      */
-    Terminal(term_type_t type, term_colors_t colors, dist_algo_t algo = ycgco);
+    Terminal(
+        term_type_t type, term_colors_t colors,
+        int width, int height, int cwidth, int cheight,
+        const std::vector<std::array<unsigned char, 3>>& palette = {},
+        dist_algo_t algo = ycgco, bool blend = true
+    );
+
+    /**
+     *  Default RGB values of the first count colors of a terminal type.
+     */
+    static std::vector<std::array<unsigned char, 3>> default_colors(term_type_t type, int count);
+
+    /**
+     *  Returns true if approximations go through the approximation cache.
+     */
+    bool uses_cache() const { return colors != truecolor && approx_mode == search; }
+
+    /**
+     *  How approximate computes its result, fixed at construction.
+     *
+     *  truecolor_kernel: the color itself.
+     *  search_kernel: lookup in the approximation cache, with a search of
+     *                 the palette on misses.
+     *  xterm256_kernel, console16_kernel: closed form approximations.
+     */
+    enum kernel_t {truecolor_kernel, search_kernel, xterm256_kernel, console16_kernel};
+    kernel_t kernel() const {
+        if (colors == truecolor) return truecolor_kernel;
+        switch (approx_mode) {
+        case xterm256: return xterm256_kernel;
+        case console16: return console16_kernel;
+        case search: break;
+        }
+        return search_kernel;
+    }
+
+    /**
+     *  Distance metric and blending of the palette.
+     */
+    dist_algo_t algorithm() const { return algo; }
+    bool blends() const { return blend; }
+
+    /**
+     *  Same as approximate, for a terminal whose kernel() is K and whose
+     *  algorithm() is A. Renderers select these once per frame, so that
+     *  the per-pixel work has no dispatch left, and the truecolor and cache
+     *  hit paths are inlined. If stats is not null, cache misses and their
+     *  candidates are added to it; hits are left to the caller, which
+     *  knows how many lookups it made.
+     */
+    template<kernel_t K, dist_algo_t A>
+    TermColor approximate_with(unsigned char r, unsigned char g, unsigned char b, FrameStats* stats = nullptr);
 
     /**
      *  Print the color palette
@@ -73,6 +197,7 @@ public:
     /**
      *  Returns an approximation of the given color with the palette,
      *  or the color itself if the terminal is truecolor.
+     *  Safe to call from multiple threads at once.
      */
     TermColor approximate(unsigned char r, unsigned char g, unsigned char b);
 
@@ -92,4 +217,18 @@ public:
     std::string clear_color();
 };
 
+template<Terminal::kernel_t K, dist_algo_t A>
+inline TermColor Terminal::approximate_with(unsigned char r, unsigned char g, unsigned char b, FrameStats* stats) {
+    switch (K) {
+    case truecolor_kernel: return TermColor(r, g, b);
+    case xterm256_kernel: return approximate_xterm256<A>(r, g, b);
+    case console16_kernel: return approximate_console16<A>(r, g, b);
+    case search_kernel: break;
+    }
+    int cached_idx = approx_cache[(r<<16) | (g<<8) | b].load(std::memory_order_relaxed);
+    if (cached_idx != 0)
+        return color_palette[cached_idx-1];
+    return approximate_miss<A>(r, g, b, stats);
+}
+
 #endif
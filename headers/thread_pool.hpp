@@ -0,0 +1,83 @@
+#ifndef TV_THREAD_POOL_HPP
+#define TV_THREAD_POOL_HPP
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+    /**
+     *  Worker threads. The thread that calls parallel_for also takes part
+     *  in the work, so there are size()-1 of them.
+     */
+    std::vector<std::thread> workers;
+
+    /**
+     *  Current job: a function to be called on every index in [0, job_size).
+     *  Indices are handed out dynamically through next_index.
+     */
+    const std::function<void(size_t)>* job = nullptr;
+    size_t job_size = 0;
+    std::atomic<size_t> next_index;
+
+    /**
+     *  First exception thrown by the current job. No more indices are
+     *  handed out after it.
+     */
+    std::exception_ptr error;
+
+    /**
+     *  Synchronization state. generation is incremented for every new job,
+     *  and busy counts the workers that did not finish the current job yet.
+     */
+    std::mutex mutex;
+    std::condition_variable work_cv, done_cv;
+    unsigned long generation = 0;
+    unsigned busy = 0;
+    bool stopping = false;
+
+    /**
+     *  Held for the whole of a parallel_for call that uses the workers.
+     */
+    std::mutex call_mutex;
+
+    /**
+     *  Main loop of the worker threads.
+     */
+    void worker_loop();
+
+    /**
+     *  Process indices of the current job until there are none left.
+     */
+    void run_job();
+public:
+    /**
+     *  Create a pool that runs jobs on the given number of threads,
+     *  including the calling one. 0 means one per hardware thread.
+     */
+    ThreadPool(unsigned threads = 0);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /**
+     *  Number of threads that work on a job.
+     */
+    unsigned size() const { return workers.size() + 1; }
+
+    /**
+     *  Call fn(i) for every i in [0, n), in parallel, and wait for all the
+     *  calls to complete. If some of them throw, the remaining indices are
+     *  skipped, and the first exception is rethrown once all the running
+     *  calls are done. Must not be called from inside a job. Calls from
+     *  several threads run one after the other.
+     *  Indices are started in increasing order, so fn(i) may wait for
+     *  progress of fn(j) for any j < i.
+     */
+    void parallel_for(size_t n, const std::function<void(size_t)>& fn);
+};
+
+#endif
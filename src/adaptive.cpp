@@ -0,0 +1,64 @@
+#include "adaptive.hpp"
+
+/**
+ *  Size of a block glyph in UTF-8.
+ */
+static const double glyph_bytes = 3;
+
+/**
+ *  Weight of a new measurement in the moving averages.
+ */
+static const double ewma_weight = 0.5;
+
+std::string AdaptiveChoice::mode_name() const {
+    std::string name;
+    switch (colors) {
+    case Terminal::ansi: name = "ansi"; break;
+    case Terminal::extended: name = "extended"; break;
+    case Terminal::truecolor: name = "truecolor"; break;
+    }
+    if (blend && colors != Terminal::truecolor) name += "+blend";
+    return name;
+}
+
+AdaptiveController::AdaptiveController(Terminal::term_colors_t max_colors, double budget): budget(budget) {
+    if (max_colors >= Terminal::truecolor)
+        modes.push_back({Terminal::truecolor, false, 17});
+    if (max_colors >= Terminal::extended) {
+        modes.push_back({Terminal::extended, true, 20});
+        modes.push_back({Terminal::extended, false, 11});
+    }
+    modes.push_back({Terminal::ansi, true, 14});
+    modes.push_back({Terminal::ansi, false, 10});
+}
+
+AdaptiveChoice AdaptiveController::choose(int cols, int rows) const {
+    double cells = double(cols) * rows;
+    AdaptiveChoice choice{modes[0].colors, modes[0].blend, 1, 0};
+    for (int scale=1; scale<=max_scale; scale++) {
+        for (const Mode& mode: modes) {
+            // With compact encoding, escape sequences are only needed once
+            // every scale cells in a row.
+            double bytes = cells * (glyph_bytes + mode.escape_bytes / scale);
+            choice = {mode.colors, mode.blend, scale, bytes};
+            if (rate == 0 || bytes <= rate * budget) return choice;
+        }
+    }
+    return choice;
+}
+
+void AdaptiveController::record(
+    const AdaptiveChoice& choice, size_t bytes, size_t cells, double seconds
+) {
+    if (seconds > 0) {
+        double measured = bytes / seconds;
+        rate = rate == 0 ? measured : (1-ewma_weight) * rate + ewma_weight * measured;
+    }
+    if (cells == 0) return;
+    double escape = (bytes - glyph_bytes * cells) * choice.scale / (double)cells;
+    if (escape < 0) escape = 0;
+    for (Mode& mode: modes) {
+        if (mode.colors == choice.colors && mode.blend == choice.blend)
+            mode.escape_bytes = (1-ewma_weight) * mode.escape_bytes + ewma_weight * escape;
+    }
+}
@@ -0,0 +1,86 @@
+#include "batch.hpp"
+#include "image.hpp"
+#include "render.hpp"
+#include <atomic>
+#include <map>
+#include <stdexcept>
+#include <stdio.h>
+
+static std::string output_path(const std::string& file, const std::string& out_dir) {
+    size_t slash = file.find_last_of('/');
+    std::string name = slash == std::string::npos ? file : file.substr(slash+1);
+    size_t dot = name.find_last_of('.');
+    if (dot != std::string::npos && dot > 0) name = name.substr(0, dot);
+    return out_dir + "/" + name + ".ans";
+}
+
+size_t render_batch(
+    Terminal& term, const std::vector<std::string>& files,
+    const std::string& out_dir, ThreadPool& pool, Stats* stats,
+    dither_t method
+) {
+    std::atomic<size_t> failed(0);
+    std::vector<FrameStats> frames(stats ? files.size() : 0);
+    // Files with the same name in different directories would be written
+    // to the same path: only the first of them is rendered.
+    std::vector<std::string> paths(files.size());
+    std::vector<bool> duplicate(files.size(), false);
+    std::map<std::string, size_t> owners;
+    for (size_t i=0; i<files.size(); i++) {
+        paths[i] = output_path(files[i], out_dir);
+        auto owner = owners.emplace(paths[i], i);
+        if (owner.second) continue;
+        fprintf(stderr, "%s and %s would both be written to %s!\n",
+            files[owner.first->second].c_str(), files[i].c_str(), paths[i].c_str());
+        duplicate[i] = true;
+        failed++;
+    }
+    pool.parallel_for(files.size(), [&](size_t i) {
+        FrameStats* frame = stats ? &frames[i] : nullptr;
+        if (frame) frame->file = files[i];
+        if (duplicate[i]) return;
+        try {
+            auto stage_start = Stats::clock::now();
+            Image img{files[i]};
+            if (frame) frame->decode = Stats::since(stage_start);
+            stage_start = Stats::clock::now();
+            img.downscale(term.width, term.height, term.cwidth, term.cheight);
+            if (frame) frame->downscale = Stats::since(stage_start);
+            stage_start = Stats::clock::now();
+            // The pool is busy with the files: a pool of one thread
+            // dithers on the calling one, without starting any thread.
+            ThreadPool single(1);
+            dither(img, term, method, single);
+            if (frame) frame->dither = Stats::since(stage_start);
+
+            // Each file is rendered by a single thread: parallelism comes
+            // from processing many files at once.
+            stage_start = Stats::clock::now();
+            std::string out;
+            RenderOptions options;
+            options.layout = inline_rows;
+            render_rows(term, img, 0, img.height, 0, 0, out, frame, options);
+            if (frame) {
+                frame->render = Stats::since(stage_start);
+                frame->bytes = out.size();
+            }
+
+            stage_start = Stats::clock::now();
+            const std::string& path = paths[i];
+            FILE* f = fopen(path.c_str(), "w");
+            if (f == NULL)
+                throw std::runtime_error("Could not open " + path);
+            bool ok = fwrite(out.data(), 1, out.size(), f) == out.size();
+            ok = fclose(f) == 0 && ok;
+            if (!ok)
+                throw std::runtime_error("Could not write " + path);
+            if (frame) frame->write = Stats::since(stage_start);
+        } catch (std::exception& e) {
+            fprintf(stderr, "%s\n", e.what());
+            failed++;
+        }
+    });
+    if (stats)
+        for (auto& frame: frames) stats->frames.push_back(frame);
+    return failed;
+}
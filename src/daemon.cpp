@@ -0,0 +1,433 @@
+#include "daemon.hpp"
+#include "image.hpp"
+#include "render.hpp"
+#include "stats.hpp"
+#include "thread_pool.hpp"
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+
+static const size_t max_message = 1<<16;
+
+static const char* type_name(Terminal::term_type_t type) {
+    return type == Terminal::console ? "console" : "xterm";
+}
+
+static const char* colors_name(Terminal::term_colors_t colors) {
+    switch (colors) {
+    case Terminal::ansi: return "ansi";
+    case Terminal::extended: return "extended";
+    case Terminal::truecolor: return "truecolor";
+    }
+    return "ansi";
+}
+
+static const char* dither_name(dither_t method) {
+    switch (method) {
+    case no_dither: return "none";
+    case bayer_dither: return "bayer";
+    case blue_noise_dither: return "blue-noise";
+    case diffusion_dither: return "diffusion";
+    }
+    return "none";
+}
+
+static std::string color_hex(const std::array<unsigned char, 3>& color) {
+    char buf[8];
+    snprintf(buf, sizeof(buf), "#%02x%02x%02x", color[0], color[1], color[2]);
+    return buf;
+}
+
+std::string DaemonRequest::fingerprint() const {
+    std::string ret = type_name(type);
+    ret += " ";
+    ret += colors_name(colors);
+    ret += blend ? " blend" : " noblend";
+    for (const auto& c: palette) ret += " " + color_hex(c);
+    return ret;
+}
+
+std::string DaemonRequest::serialize() const {
+    if (image.find('\n') != std::string::npos)
+        throw std::invalid_argument("Image paths cannot contain newlines!");
+    std::string ret = "image " + image + "\n";
+    ret += "type " + std::string(type_name(type)) + "\n";
+    ret += "colors " + std::string(colors_name(colors)) + "\n";
+    ret += blend ? "blend 1\n" : "blend 0\n";
+    ret += "size " + std::to_string(width) + "x" + std::to_string(height) + "\n";
+    ret += "cell " + std::to_string(cwidth) + "x" + std::to_string(cheight) + "\n";
+    ret += "dither " + std::string(dither_name(dither)) + "\n";
+    for (const auto& c: palette) ret += "color " + color_hex(c) + "\n";
+    return ret;
+}
+
+static bool parse_pair(const std::string& s, int& w, int& h) {
+    char* pos;
+    w = strtol(s.c_str(), &pos, 10);
+    if (*pos != 'x') return false;
+    h = strtol(pos+1, &pos, 10);
+    return !*pos && w > 0 && h > 0;
+}
+
+DaemonRequest DaemonRequest::parse(const std::string& msg) {
+    DaemonRequest req;
+    std::istringstream in(msg);
+    std::string line;
+    bool has_size = false, has_cell = false;
+    while (std::getline(in, line)) {
+        if (line.empty()) continue;
+        size_t space = line.find(' ');
+        std::string key = line.substr(0, space);
+        std::string value = space == std::string::npos ? "" : line.substr(space+1);
+        bool valid = true;
+        if (key == "image") {
+            req.image = value;
+        } else if (key == "type") {
+            valid = value == "xterm" || value == "console";
+            req.type = value == "console" ? Terminal::console : Terminal::xterm;
+        } else if (key == "colors") {
+            if (value == "ansi") req.colors = Terminal::ansi;
+            else if (value == "extended") req.colors = Terminal::extended;
+            else if (value == "truecolor") req.colors = Terminal::truecolor;
+            else valid = false;
+        } else if (key == "blend") {
+            valid = value == "0" || value == "1";
+            req.blend = value == "1";
+        } else if (key == "dither") {
+            if (value == "none") req.dither = no_dither;
+            else if (value == "bayer") req.dither = bayer_dither;
+            else if (value == "blue-noise") req.dither = blue_noise_dither;
+            else if (value == "diffusion") req.dither = diffusion_dither;
+            else valid = false;
+        } else if (key == "size") {
+            valid = has_size = parse_pair(value, req.width, req.height);
+        } else if (key == "cell") {
+            valid = has_cell = parse_pair(value, req.cwidth, req.cheight);
+        } else if (key == "color") {
+            // Exactly #rrggbb: strtol would also take signs and spaces.
+            std::array<unsigned char, 3> c;
+            valid = value.size() == 7 && value[0] == '#' &&
+                std::all_of(value.begin()+1, value.end(), [](char x) { return isxdigit((unsigned char)x); });
+            for (int k=0; valid && k<3; k++)
+                c[k] = strtol(value.substr(1+2*k, 2).c_str(), nullptr, 16);
+            valid = valid && req.palette.size() < 256;
+            if (valid) req.palette.push_back(c);
+        } else {
+            valid = false;
+        }
+        if (!valid) throw std::runtime_error("Invalid request line: " + line);
+    }
+    if (req.image.empty() || !has_size || !has_cell)
+        throw std::runtime_error("Incomplete request!");
+    return req;
+}
+
+/**
+ *  Send a message, optionally with a file descriptor attached.
+ */
+static void send_message(int sock, const std::string& msg, int fd) {
+    struct iovec iov;
+    iov.iov_base = const_cast<char*>(msg.data());
+    iov.iov_len = msg.size();
+    struct msghdr hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    char control[CMSG_SPACE(sizeof(int))];
+    if (fd != -1) {
+        memset(control, 0, sizeof(control));
+        hdr.msg_control = control;
+        hdr.msg_controllen = sizeof(control);
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+    while (sendmsg(sock, &hdr, MSG_NOSIGNAL) == -1) {
+        if (errno != EINTR)
+            throw std::system_error(errno, std::generic_category(), "Could not send to the daemon socket");
+    }
+}
+
+/**
+ *  Receive a message, and the file descriptor attached to it if any (or
+ *  -1). Returns false when the peer closed the connection.
+ */
+static bool receive_message(int sock, std::string& msg, int& fd) {
+    std::vector<char> buf(max_message);
+    struct iovec iov;
+    iov.iov_base = buf.data();
+    iov.iov_len = buf.size();
+    struct msghdr hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    char control[CMSG_SPACE(sizeof(int))];
+    hdr.msg_control = control;
+    hdr.msg_controllen = sizeof(control);
+    ssize_t len;
+    while ((len = recvmsg(sock, &hdr, MSG_CMSG_CLOEXEC)) == -1) {
+        if (errno != EINTR)
+            throw std::system_error(errno, std::generic_category(), "Could not read from the daemon socket");
+    }
+    fd = -1;
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr); cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+            memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    }
+    if (len == 0) {
+        if (fd != -1) close(fd);
+        return false;
+    }
+    msg.assign(buf.data(), len);
+    return true;
+}
+
+static struct sockaddr_un socket_address(const std::string& path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+        throw std::invalid_argument("Socket path too long: " + path);
+    strcpy(addr.sun_path, path.c_str());
+    return addr;
+}
+
+namespace {
+
+/**
+ *  Warm terminals, by configuration fingerprint. Connections use it
+ *  concurrently, and keep the terminal they got even if it is dropped.
+ */
+class TerminalCache {
+    struct Entry {
+        std::shared_ptr<Terminal> term;
+        unsigned long long last_used;
+    };
+    std::map<std::string, Entry> entries;
+    unsigned long long uses = 0;
+    size_t max_entries;
+    std::mutex mutex;
+public:
+    TerminalCache(size_t max_entries): max_entries(max_entries) {}
+
+    std::shared_ptr<Terminal> get(const DaemonRequest& req) {
+        std::string key = req.fingerprint();
+        std::lock_guard<std::mutex> lck(mutex);
+        auto it = entries.find(key);
+        if (it == entries.end()) {
+            if (entries.size() >= max_entries) {
+                auto oldest = entries.begin();
+                for (auto e = entries.begin(); e != entries.end(); e++)
+                    if (e->second.last_used < oldest->second.last_used) oldest = e;
+                entries.erase(oldest);
+            }
+            std::shared_ptr<Terminal> term(new Terminal(
+                req.type, req.colors, req.width, req.height, req.cwidth, req.cheight,
+                req.palette, ycgco, req.blend
+            ));
+            it = entries.emplace(key, Entry{std::move(term), 0}).first;
+        }
+        it->second.last_used = uses++;
+        return it->second.term;
+    }
+};
+
+}
+
+/**
+ *  Open the terminal behind fd again, as a non-blocking descriptor that
+ *  does not change the flags of the client's one, or return -1 if fd is
+ *  not a terminal or cannot be opened again.
+ */
+static int reopen_nonblocking(int fd) {
+    if (!isatty(fd)) return -1;
+    std::string path = "/proc/self/fd/" + std::to_string(fd);
+    return open(path.c_str(), O_WRONLY | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+}
+
+/**
+ *  Render the requested image to fd. The frame stops as soon as the client
+ *  sends anything or hangs up on conn, rather than being written to a
+ *  terminal that nobody waits for.
+ */
+static DaemonReply handle_request(const DaemonRequest& req, int fd, int conn, TerminalCache& terminals, ThreadPool& pool) {
+    DaemonReply reply;
+    std::shared_ptr<Terminal> term_ptr = terminals.get(req);
+    Terminal& term = *term_ptr;
+    auto start = Stats::clock::now();
+    Image img{req.image};
+    reply.decode = Stats::since(start);
+    start = Stats::clock::now();
+    // The cached terminal may have been created for another geometry, so
+    // only the geometry of the request is used.
+    img.downscale(req.width, req.height, req.cwidth, req.cheight);
+    reply.downscale = Stats::since(start);
+    start = Stats::clock::now();
+    dither(img, term, req.dither, pool);
+    reply.dither = Stats::since(start);
+    int start_row = std::max(0, (req.height-(int)img.height)/2) + 1;
+    int start_col = std::max(0, (req.width-(int)img.width)/2) + 1;
+    start = Stats::clock::now();
+    // A terminal that stopped reading (^S, a suspended emulator) must
+    // not keep the frame from noticing that its client went away.
+    int out = reopen_nonblocking(fd);
+    RenderOptions options;
+    options.cancel_fd = conn;
+    try {
+        reply.bytes = stream_image(
+            term, img, start_col, start_row, pool, out != -1 ? out : fd,
+            term.clear(), term.move_to(1, 1000), nullptr, options
+        );
+    } catch (...) {
+        if (out != -1) close(out);
+        throw;
+    }
+    if (out != -1) close(out);
+    reply.render = Stats::since(start);
+    reply.ok = true;
+    return reply;
+}
+
+static std::string serialize_reply(const DaemonReply& reply) {
+    if (!reply.ok) return "error " + reply.error;
+    char buf[128];
+    snprintf(
+        buf, sizeof(buf), "ok %zu %.9f %.9f %.9f %.9f",
+        reply.bytes, reply.decode, reply.downscale, reply.dither, reply.render
+    );
+    return buf;
+}
+
+static DaemonReply parse_reply(const std::string& msg) {
+    DaemonReply reply;
+    if (msg.compare(0, 6, "error ") == 0) {
+        reply.error = msg.substr(6);
+        return reply;
+    }
+    if (sscanf(
+        msg.c_str(), "ok %zu %lf %lf %lf %lf",
+        &reply.bytes, &reply.decode, &reply.downscale, &reply.dither, &reply.render
+    ) != 5)
+        throw std::runtime_error("Invalid reply from the daemon!");
+    reply.ok = true;
+    return reply;
+}
+
+/**
+ *  Whether the peer of a connected socket runs as the same user as this
+ *  process. Requests make the daemon open files and write to the terminal
+ *  they carry, so other users are not served.
+ */
+static bool same_user(int conn) {
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    if (getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1) return false;
+    return cred.uid == getuid();
+}
+
+/**
+ *  Serve the requests of a connection until the client closes it.
+ */
+static void serve_connection(int conn, TerminalCache& terminals, ThreadPool& pool) {
+    while (true) {
+        std::string msg;
+        int fd = -1;
+        try {
+            if (!receive_message(conn, msg, fd)) break;
+        } catch (std::system_error&) {
+            break;
+        }
+        DaemonReply reply;
+        try {
+            if (fd == -1) throw std::runtime_error("No terminal was sent with the request!");
+            reply = handle_request(DaemonRequest::parse(msg), fd, conn, terminals, pool);
+        } catch (std::exception& e) {
+            reply.ok = false;
+            reply.error = e.what();
+        }
+        if (fd != -1) close(fd);
+        try {
+            send_message(conn, serialize_reply(reply), -1);
+        } catch (std::system_error&) {
+            break;
+        }
+    }
+    close(conn);
+}
+
+void run_daemon(const std::string& path, unsigned threads, size_t max_terminals) {
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock == -1)
+        throw std::system_error(errno, std::generic_category(), "Could not create the daemon socket");
+    struct sockaddr_un addr = socket_address(path);
+    unlink(path.c_str());
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) == -1 || listen(sock, 16) == -1) {
+        int err = errno;
+        close(sock);
+        throw std::system_error(err, std::generic_category(), "Could not listen on " + path);
+    }
+    // Clients that go away while a frame is written must not kill us.
+    signal(SIGPIPE, SIG_IGN);
+    ThreadPool pool(threads);
+    TerminalCache terminals(max_terminals);
+
+    // Every connection has its own thread, so that a client whose terminal
+    // does not read its frame only holds up itself. The threads take turns
+    // on the pool. They are never joined: this function does not return.
+    while (true) {
+        int conn = accept4(sock, nullptr, nullptr, SOCK_CLOEXEC);
+        if (conn == -1) continue;
+        if (!same_user(conn)) {
+            close(conn);
+            continue;
+        }
+        try {
+            std::thread(serve_connection, conn, std::ref(terminals), std::ref(pool)).detach();
+        } catch (std::system_error&) {
+            close(conn);
+        }
+    }
+}
+
+DaemonClient::DaemonClient(const std::string& path) {
+    sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock == -1)
+        throw std::system_error(errno, std::generic_category(), "Could not create the daemon socket");
+    struct sockaddr_un addr = socket_address(path);
+    if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        int err = errno;
+        close(sock);
+        throw std::system_error(err, std::generic_category(), "Could not connect to the daemon at " + path);
+    }
+}
+
+DaemonClient::~DaemonClient() {
+    close(sock);
+}
+
+DaemonReply DaemonClient::render(const DaemonRequest& request, int fd) {
+    send_message(sock, request.serialize(), fd);
+    std::string msg;
+    int unused;
+    if (!receive_message(sock, msg, unused))
+        throw std::runtime_error("The daemon closed the connection!");
+    if (unused != -1) close(unused);
+    return parse_reply(msg);
+}
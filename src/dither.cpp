@@ -0,0 +1,197 @@
+#include "dither.hpp"
+#include <algorithm>
+#include <atomic>
+#include <math.h>
+#include <random>
+#include <thread>
+#include <vector>
+
+/**
+ *  8x8 Bayer matrix: the index of each cell is the bit reversal of the
+ *  interleaved bits of x^y and y.
+ */
+struct BayerMatrix {
+    float threshold[64];
+    constexpr BayerMatrix(): threshold() {
+        for (int y=0; y<8; y++) {
+            for (int x=0; x<8; x++) {
+                int v = 0;
+                for (int bit=0; bit<3; bit++) {
+                    v = (v << 1) | (((x ^ y) >> bit) & 1);
+                    v = (v << 1) | ((y >> bit) & 1);
+                }
+                threshold[8*y+x] = (v + 0.5f) / 64 - 0.5f;
+            }
+        }
+    }
+};
+
+static constexpr BayerMatrix bayer_matrix;
+
+static const int blue_noise_size = 32;
+
+/**
+ *  Blue noise threshold map, made with the void and cluster method:
+ *  starting from a relaxed random pattern, points are ranked by removing
+ *  the tightest clusters and then by filling the largest voids, where
+ *  tightness is the sum of a gaussian of the toroidal distance to all
+ *  the points of the pattern.
+ */
+static std::vector<float> make_blue_noise() {
+    const int n = blue_noise_size;
+    const int size = n*n;
+    const double sigma = 1.5;
+    std::vector<double> kernel(size);
+    for (int dy=0; dy<n; dy++) {
+        for (int dx=0; dx<n; dx++) {
+            double ddx = std::min(dx, n-dx), ddy = std::min(dy, n-dy);
+            kernel[dy*n+dx] = exp(-(ddx*ddx + ddy*ddy) / (2*sigma*sigma));
+        }
+    }
+    std::vector<char> pattern(size);
+    std::vector<double> energy(size);
+    auto toggle = [&](int p, bool on) {
+        pattern[p] = on;
+        int px = p % n, py = p / n;
+        double sign = on ? 1 : -1;
+        for (int q=0; q<size; q++)
+            energy[q] += sign * kernel[((q/n - py + n) % n)*n + (q%n - px + n) % n];
+    };
+    auto tightest_cluster = [&]() {
+        int best = -1;
+        for (int p=0; p<size; p++)
+            if (pattern[p] && (best == -1 || energy[p] > energy[best])) best = p;
+        return best;
+    };
+    auto largest_void = [&]() {
+        int best = -1;
+        for (int p=0; p<size; p++)
+            if (!pattern[p] && (best == -1 || energy[p] < energy[best])) best = p;
+        return best;
+    };
+
+    std::mt19937 rng(1);
+    int ones = size / 10;
+    for (int placed=0; placed<ones;) {
+        int p = rng() % size;
+        if (pattern[p]) continue;
+        toggle(p, true);
+        placed++;
+    }
+    while (true) {
+        int cluster = tightest_cluster();
+        toggle(cluster, false);
+        int gap = largest_void();
+        toggle(gap, true);
+        if (gap == cluster) break;
+    }
+
+    std::vector<int> rank(size);
+    auto initial_pattern = pattern;
+    auto initial_energy = energy;
+    for (int r=ones-1; r>=0; r--) {
+        int cluster = tightest_cluster();
+        toggle(cluster, false);
+        rank[cluster] = r;
+    }
+    pattern = initial_pattern;
+    energy = initial_energy;
+    for (int r=ones; r<size; r++) {
+        int gap = largest_void();
+        toggle(gap, true);
+        rank[gap] = r;
+    }
+
+    std::vector<float> thresholds(size);
+    for (int p=0; p<size; p++)
+        thresholds[p] = (rank[p] + 0.5f) / size - 0.5f;
+    return thresholds;
+}
+
+/**
+ *  Spread of the ordered dithering offsets, about the distance between
+ *  neighbouring colors of the palette.
+ */
+static float dither_amplitude(Terminal& term) {
+    if (term.colors == Terminal::ansi) return term.blends() ? 48 : 128;
+    return term.blends() ? 16 : 40;
+}
+
+static inline unsigned char clamp_channel(float v) {
+    return v < 0 ? 0 : v > 255 ? 255 : (unsigned char)(v + 0.5f);
+}
+
+static void ordered_dither(Image& img, const float* map, int map_size, float amplitude, ThreadPool& pool) {
+    char* data = img.data();
+    size_t width = img.width;
+    pool.parallel_for(img.height, [&](size_t y) {
+        const float* row_map = map + (y % map_size) * map_size;
+        char* row = data + 3*y*width;
+        for (size_t x=0; x<width; x++) {
+            float offset = amplitude * row_map[x % map_size];
+            for (int c=0; c<3; c++)
+                row[3*x+c] = clamp_channel((unsigned char)row[3*x+c] + offset);
+        }
+    });
+}
+
+static void error_diffusion(Image& img, Terminal& term, ThreadPool& pool) {
+    char* data = img.data();
+    size_t width = img.width, height = img.height;
+    // Error carried to each pixel by the previous row, and number of
+    // pixels of each row that are done.
+    std::vector<float> carried(3*width*height);
+    std::vector<std::atomic<size_t>> progress(height);
+    pool.parallel_for(height, [&](size_t y) {
+        float right[3] = {0, 0, 0};
+        float* below = y+1 < height ? &carried[3*(y+1)*width] : nullptr;
+        for (size_t x=0; x<width; x++) {
+            // Pixels x-1, x and x+1 of the previous row carry error to
+            // this one.
+            if (y > 0) {
+                size_t needed = std::min(width, x+2);
+                while (progress[y-1].load(std::memory_order_acquire) < needed)
+                    std::this_thread::yield();
+            }
+            char* px = data + 3*(y*width+x);
+            const float* in = &carried[3*(y*width+x)];
+            unsigned char want[3];
+            for (int c=0; c<3; c++)
+                want[c] = clamp_channel((unsigned char)px[c] + in[c] + right[c]);
+            TermColor shown = term.approximate(want[0], want[1], want[2]);
+            float error[3] = {
+                float(want[0]) - shown.r,
+                float(want[1]) - shown.g,
+                float(want[2]) - shown.b
+            };
+            for (int c=0; c<3; c++) {
+                px[c] = want[c];
+                right[c] = error[c] * 7 / 16;
+                if (!below) continue;
+                if (x > 0) below[3*(x-1)+c] += error[c] * 3 / 16;
+                below[3*x+c] += error[c] * 5 / 16;
+                if (x+1 < width) below[3*(x+1)+c] += error[c] * 1 / 16;
+            }
+            progress[y].store(x+1, std::memory_order_release);
+        }
+    });
+}
+
+void dither(Image& img, Terminal& term, dither_t method, ThreadPool& pool) {
+    if (term.colors == Terminal::truecolor) return;
+    switch (method) {
+    case no_dither:
+        break;
+    case bayer_dither:
+        ordered_dither(img, bayer_matrix.threshold, 8, dither_amplitude(term), pool);
+        break;
+    case blue_noise_dither: {
+        static const std::vector<float> blue_noise = make_blue_noise();
+        ordered_dither(img, blue_noise.data(), blue_noise_size, dither_amplitude(term), pool);
+        break;
+    }
+    case diffusion_dither:
+        error_diffusion(img, term, pool);
+        break;
+    }
+}
@@ -0,0 +1,356 @@
+#include "event_loop.hpp"
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+
+static void add_fd(int epoll_fd, int fd) {
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1)
+        throw std::system_error(errno, std::generic_category(), "epoll_ctl failed");
+}
+
+/**
+ *  Terminal to restore when a signal interrupts a slide, and its settings.
+ *  Only read by the signal handler.
+ */
+static int interrupt_tty = -1;
+static struct termios interrupt_term;
+
+/**
+ *  Handler of the termination signals while they are unblocked around
+ *  present: the terminal is restored, the output that was not sent yet is
+ *  dropped, and the signal is raised again with its default action once
+ *  the handler returns. Only async-signal-safe functions are used.
+ */
+static void interrupt_handler(int sig) {
+    if (interrupt_tty != -1) tcsetattr(interrupt_tty, TCSANOW, &interrupt_term);
+    // Nothing is written: a writer thread may hold the terminal until its
+    // whole frame is sent.
+    if (isatty(STDOUT_FILENO)) tcflush(STDOUT_FILENO, TCOFLUSH);
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+static const int termination_signals[] = {SIGINT, SIGTERM, SIGHUP};
+
+EventLoop::EventLoop(bool keyboard) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    for (int sig: termination_signals) sigaddset(&mask, sig);
+    pthread_sigmask(SIG_BLOCK, &mask, &initial_mask);
+    // The handler only runs on a thread that unblocked the signals.
+    struct sigaction action = {};
+    action.sa_handler = interrupt_handler;
+    sigemptyset(&action.sa_mask);
+    for (size_t i=0; i<3; i++)
+        sigaction(termination_signals[i], &action, &initial_actions[i]);
+    try {
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+        signal_fd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+        event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (epoll_fd == -1 || timer_fd == -1 || signal_fd == -1 || event_fd == -1)
+            throw std::system_error(errno, std::generic_category(), "Could not create the event loop");
+        add_fd(epoll_fd, timer_fd);
+        add_fd(epoll_fd, signal_fd);
+        add_fd(epoll_fd, event_fd);
+        if (keyboard && isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO, &initial_term) == 0) {
+            // Signals are still generated by the terminal, so that ^C
+            // arrives through the signalfd.
+            struct termios term = initial_term;
+            term.c_lflag &= ~(ICANON | ECHO);
+            term.c_cc[VMIN] = 0;
+            term.c_cc[VTIME] = 0;
+            tcsetattr(STDIN_FILENO, TCSANOW, &term);
+            tty_fd = STDIN_FILENO;
+            interrupt_term = initial_term;
+            interrupt_tty = tty_fd;
+            add_fd(epoll_fd, tty_fd);
+        }
+    } catch (...) {
+        release();
+        throw;
+    }
+}
+
+void EventLoop::release() {
+    if (tty_fd != -1) tcsetattr(tty_fd, TCSANOW, &initial_term);
+    interrupt_tty = -1;
+    for (int fd: {epoll_fd, timer_fd, signal_fd, event_fd})
+        if (fd != -1) close(fd);
+    for (size_t i=0; i<3; i++)
+        sigaction(termination_signals[i], &initial_actions[i], nullptr);
+    pthread_sigmask(SIG_SETMASK, &initial_mask, nullptr);
+}
+
+void EventLoop::interruptible(bool enable) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    for (int sig: termination_signals) sigaddset(&mask, sig);
+    pthread_sigmask(enable ? SIG_UNBLOCK : SIG_BLOCK, &mask, nullptr);
+}
+
+EventLoop::~EventLoop() {
+    release();
+}
+
+void EventLoop::set_deadline(Stats::clock::time_point when) {
+    // The steady clock is CLOCK_MONOTONIC, so the deadline can be given as
+    // an absolute time. A zero value would disarm the timer.
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(when.time_since_epoch()).count();
+    ns = std::max<long long>(ns, 1);
+    struct itimerspec spec = {};
+    spec.it_value.tv_sec = ns / 1000000000;
+    spec.it_value.tv_nsec = ns % 1000000000;
+    if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, nullptr) == -1)
+        throw std::system_error(errno, std::generic_category(), "timerfd_settime failed");
+}
+
+void EventLoop::clear_deadline() {
+    struct itimerspec spec = {};
+    timerfd_settime(timer_fd, 0, &spec, nullptr);
+    // An expiration that was not read yet would still be reported.
+    uint64_t expirations;
+    while (read(timer_fd, &expirations, sizeof(expirations)) > 0) {}
+}
+
+void EventLoop::notify() {
+    uint64_t one = 1;
+    while (write(event_fd, &one, sizeof(one)) == -1 && errno == EINTR) {}
+}
+
+/**
+ *  Longest unterminated string kept while waiting for its end.
+ */
+static const size_t max_string = 4096;
+
+/**
+ *  Remove the first key from the buffer, and return whether it was one of
+ *  the known ones. Escape sequences that are not complete yet are kept.
+ */
+static bool parse_key(std::string& keys, EventLoop::event_t& event) {
+    static const struct {
+        const char* key;
+        EventLoop::event_t event;
+    } bindings[] = {
+        {"\033[C", EventLoop::next}, {"\033[6~", EventLoop::next},
+        {"\033[D", EventLoop::previous}, {"\033[5~", EventLoop::previous},
+        {"n", EventLoop::next}, {"l", EventLoop::next}, {"j", EventLoop::next},
+        {"b", EventLoop::previous}, {"h", EventLoop::previous}, {"k", EventLoop::previous},
+        {" ", EventLoop::pause}, {"p", EventLoop::pause},
+        {"q", EventLoop::quit},
+    };
+    while (!keys.empty()) {
+        for (const auto& b: bindings) {
+            size_t len = strlen(b.key);
+            if (keys.compare(0, len, b.key) != 0) continue;
+            keys.erase(0, len);
+            event = b.event;
+            return true;
+        }
+        if (keys[0] != '\033') {
+            keys.erase(0, 1);
+            continue;
+        }
+        if (keys.size() < 2) return false;
+        // Skip strings, such as late replies to the probe queries (OSC 4,
+        // kitty graphics APC), up to BEL or ST: their contents are not keys.
+        if (keys[1] == ']' || keys[1] == '_' || keys[1] == 'P' || keys[1] == '^' || keys[1] == 'X') {
+            size_t bel = keys.find('\007', 2);
+            size_t st = keys.find("\033\\", 2);
+            size_t end = std::min(bel, st);
+            if (end == std::string::npos) {
+                // Wait for the rest, unless it never ends.
+                if (keys.size() < max_string) return false;
+                keys.clear();
+                return false;
+            }
+            keys.erase(0, end + (end == bel ? 1 : 2));
+            continue;
+        }
+        // Skip an unknown escape sequence, up to its final byte.
+        if (keys[1] != '[') {
+            keys.erase(0, 1);
+            continue;
+        }
+        size_t end = 2;
+        while (end < keys.size() && (keys[end] < 0x40 || keys[end] > 0x7e)) end++;
+        if (end == keys.size()) return false;
+        keys.erase(0, end+1);
+    }
+    return false;
+}
+
+EventLoop::event_t EventLoop::wait() {
+    while (true) {
+        event_t event;
+        if (parse_key(keys, event)) return event;
+        struct epoll_event ev;
+        int ret = epoll_wait(epoll_fd, &ev, 1, -1);
+        if (ret == -1 && errno == EINTR) continue;
+        if (ret == -1)
+            throw std::system_error(errno, std::generic_category(), "epoll_wait failed");
+        // Only one file descriptor is handled at a time: the others are
+        // still readable and are reported by the following calls.
+        if (ev.data.fd == signal_fd) {
+            struct signalfd_siginfo info;
+            if (read(signal_fd, &info, sizeof(info)) == sizeof(info)) return quit;
+        } else if (ev.data.fd == event_fd) {
+            uint64_t count;
+            if (read(event_fd, &count, sizeof(count)) == sizeof(count)) return notified;
+        } else if (ev.data.fd == timer_fd) {
+            uint64_t expirations;
+            if (read(timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations)) return deadline;
+        } else if (ev.data.fd == tty_fd) {
+            char data[256];
+            ssize_t len = read(tty_fd, data, sizeof(data));
+            if (len > 0) {
+                keys.append(data, len);
+            } else if (len == 0 || errno != EINTR) {
+                // The terminal is gone: stop polling it.
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, tty_fd, nullptr);
+            }
+        }
+    }
+}
+
+void run_slideshow(
+    EventLoop& loop, size_t count, double interval,
+    const std::function<void(size_t)>& prepare,
+    const std::function<void(size_t, double, const Stats::clock::time_point*)>& present
+) {
+    if (count == 0) return;
+    auto interval_duration = std::chrono::duration_cast<Stats::clock::duration>(
+        std::chrono::duration<double>(interval));
+    const size_t none = -1;
+    // Slide to present next, and whether it is due. Only slides that are
+    // due because of the timer have a deadline that can be missed.
+    size_t target = 0;
+    bool due = true;
+    bool timed = false;
+    Stats::clock::time_point deadline;
+    // Slide on screen, and whether the slideshow ends at the next deadline.
+    size_t shown = none;
+    bool last = false;
+    bool paused = false;
+    // Background preparation: the slide being prepared, if any, and the
+    // last one that completed, with the time when it did.
+    std::thread worker;
+    size_t preparing = none;
+    size_t prepared = none;
+    Stats::clock::time_point prepared_time;
+    std::exception_ptr error;
+    auto start = [&](size_t index) {
+        preparing = index;
+        worker = std::thread([&, index]() {
+            try {
+                prepare(index);
+            } catch (...) {
+                error = std::current_exception();
+            }
+            loop.notify();
+        });
+    };
+    // Move to another slide as soon as possible.
+    auto go_to = [&](size_t index) {
+        target = index;
+        due = true;
+        timed = false;
+        last = false;
+        loop.clear_deadline();
+        if (preparing == none && prepared != target) start(target);
+    };
+
+    try {
+        start(0);
+        while (true) {
+            if (due && preparing == none && prepared == target) {
+                double miss = 0;
+                if (timed && prepared_time > deadline)
+                    miss = std::chrono::duration<double>(prepared_time - deadline).count();
+                // The loop is not waiting while the slide is drawn, which
+                // can take long on a slow link: signals end the process.
+                loop.interruptible(true);
+                try {
+                    present(target, miss, timed ? &deadline : nullptr);
+                } catch (...) {
+                    loop.interruptible(false);
+                    throw;
+                }
+                loop.interruptible(false);
+                shown = target;
+                prepared = none;
+                due = false;
+                timed = false;
+                deadline = Stats::clock::now() + interval_duration;
+                if (!paused) loop.set_deadline(deadline);
+                last = shown+1 == count;
+                if (!last) {
+                    target = shown+1;
+                    start(target);
+                }
+            }
+            switch (loop.wait()) {
+            case EventLoop::notified:
+                if (preparing == none) break;
+                worker.join();
+                if (error) std::rethrow_exception(error);
+                prepared = preparing;
+                prepared_time = Stats::clock::now();
+                preparing = none;
+                if (prepared != target) start(target);
+                break;
+            case EventLoop::deadline:
+                if (last) {
+                    if (preparing != none) worker.join();
+                    return;
+                }
+                due = true;
+                timed = true;
+                break;
+            case EventLoop::pause:
+                paused = !paused;
+                if (paused) {
+                    loop.clear_deadline();
+                } else if (!due && shown != none) {
+                    // Resuming shows the following slide after a whole
+                    // interval.
+                    deadline = Stats::clock::now() + interval_duration;
+                    loop.set_deadline(deadline);
+                }
+                break;
+            case EventLoop::next:
+                // Keys pressed before a due slide was presented move from
+                // that slide.
+                if (shown == none) break;
+                if ((due ? target : shown)+1 == count) {
+                    if (preparing != none) worker.join();
+                    return;
+                }
+                go_to((due ? target : shown)+1);
+                break;
+            case EventLoop::previous:
+                if (shown == none || (due ? target : shown) == 0) break;
+                go_to((due ? target : shown)-1);
+                break;
+            case EventLoop::quit:
+                if (preparing != none) worker.join();
+                return;
+            }
+        }
+    } catch (...) {
+        if (worker.joinable()) worker.join();
+        throw;
+    }
+}
@@ -0,0 +1,142 @@
+#include "framebuffer.hpp"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdexcept>
+#include <stdint.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+#ifdef __linux__
+#include <linux/fb.h>
+#endif
+
+FramebufferInfo FramebufferInfo::xrgb8888(unsigned width, unsigned height) {
+    FramebufferInfo info;
+    info.width = width;
+    info.height = height;
+    info.line_length = 4*width;
+    return info;
+}
+
+static void check_format(const FramebufferInfo& info) {
+    bool supported = info.bits_per_pixel == 16 || info.bits_per_pixel == 24 || info.bits_per_pixel == 32;
+    for (auto c: {info.red, info.green, info.blue})
+        if (c.length == 0 || c.length > 8 || c.offset + c.length > info.bits_per_pixel) supported = false;
+    if (!supported)
+        throw std::runtime_error("Unsupported framebuffer pixel format!");
+    if (info.line_length < (info.xoffset + info.width) * info.bits_per_pixel / 8)
+        throw std::runtime_error("Invalid framebuffer line length!");
+}
+
+void Framebuffer::map(const std::string& path) {
+    mem = (char*)mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mem == MAP_FAILED) {
+        close(fd);
+        throw std::runtime_error("Could not map " + path + ": " + strerror(errno));
+    }
+}
+
+Framebuffer::Framebuffer(const std::string& device) {
+#ifdef __linux__
+    fd = open(device.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd == -1)
+        throw std::runtime_error("Could not open " + device + ": " + strerror(errno));
+    struct fb_var_screeninfo var;
+    struct fb_fix_screeninfo fix;
+    if (ioctl(fd, FBIOGET_VSCREENINFO, &var) == -1 || ioctl(fd, FBIOGET_FSCREENINFO, &fix) == -1) {
+        close(fd);
+        throw std::runtime_error(device + " is not a framebuffer device!");
+    }
+    fb_info.width = var.xres;
+    fb_info.height = var.yres;
+    fb_info.xoffset = var.xoffset;
+    fb_info.yoffset = var.yoffset;
+    fb_info.bits_per_pixel = var.bits_per_pixel;
+    fb_info.line_length = fix.line_length;
+    fb_info.red = {var.red.offset, var.red.length};
+    fb_info.green = {var.green.offset, var.green.length};
+    fb_info.blue = {var.blue.offset, var.blue.length};
+    size = fix.smem_len;
+    if (fix.type != FB_TYPE_PACKED_PIXELS || fix.visual != FB_VISUAL_TRUECOLOR ||
+        size < (size_t)fb_info.line_length * (fb_info.yoffset + fb_info.height)) {
+        close(fd);
+        throw std::runtime_error("Unsupported framebuffer type!");
+    }
+    try {
+        check_format(fb_info);
+    } catch (...) {
+        close(fd);
+        throw;
+    }
+    map(device);
+#else
+    throw std::runtime_error("Framebuffers are only supported on Linux!");
+#endif
+}
+
+Framebuffer::Framebuffer(const std::string& path, const FramebufferInfo& info): fb_info(info) {
+    check_format(fb_info);
+    fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1)
+        throw std::runtime_error("Could not open " + path + ": " + strerror(errno));
+    size = (size_t)fb_info.line_length * (fb_info.yoffset + fb_info.height);
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (S_ISREG(st.st_mode) && (size_t)st.st_size < size && ftruncate(fd, size) == -1)) {
+        close(fd);
+        throw std::runtime_error("Could not resize " + path + ": " + strerror(errno));
+    }
+    map(path);
+}
+
+Framebuffer::~Framebuffer() {
+    munmap(mem, size);
+    close(fd);
+}
+
+/**
+ *  Convert a row of RGB pixels to the pixel format of the framebuffer.
+ */
+static void convert_row(const FramebufferInfo& info, const char* src, size_t count, char* dst) {
+    const unsigned char* in = (const unsigned char*)src;
+    if (info.bits_per_pixel == 32 && info.red.length == 8 && info.green.length == 8 && info.blue.length == 8 &&
+        info.red.offset % 8 == 0 && info.green.offset % 8 == 0 && info.blue.offset % 8 == 0) {
+        // Byte aligned 8-bit channels: store the bytes directly.
+        uint32_t* out = (uint32_t*)dst;
+        for (size_t i=0; i<count; i++) {
+            out[i] = (uint32_t(in[3*i]) << info.red.offset) |
+                     (uint32_t(in[3*i+1]) << info.green.offset) |
+                     (uint32_t(in[3*i+2]) << info.blue.offset);
+        }
+        return;
+    }
+    size_t bytes = info.bits_per_pixel / 8;
+    for (size_t i=0; i<count; i++) {
+        uint32_t v = (uint32_t(in[3*i] >> (8-info.red.length)) << info.red.offset) |
+                     (uint32_t(in[3*i+1] >> (8-info.green.length)) << info.green.offset) |
+                     (uint32_t(in[3*i+2] >> (8-info.blue.length)) << info.blue.offset);
+        // Pixels are stored in host byte order, assumed little endian.
+        memcpy(dst + i*bytes, &v, bytes);
+    }
+}
+
+size_t Framebuffer::draw(const Image& img, int x, int y, ThreadPool& pool) {
+    // Clip the image to the visible area.
+    int skip_x = std::max(0, -x), skip_y = std::max(0, -y);
+    int cols = std::min<int>(img.width, (int)fb_info.width - x) - skip_x;
+    int rows = std::min<int>(img.height, (int)fb_info.height - y) - skip_y;
+    if (cols <= 0 || rows <= 0) return 0;
+    size_t bytes = (size_t)cols * (fb_info.bits_per_pixel / 8);
+    pool.parallel_for(rows, [&](size_t r) {
+        std::vector<char> row(bytes + 3);
+        int sy = skip_y + r;
+        convert_row(fb_info, img.data() + 3*(sy*img.width + skip_x), cols, row.data());
+        size_t offset = (size_t)(fb_info.yoffset + y + sy) * fb_info.line_length +
+                        (size_t)(fb_info.xoffset + x + skip_x) * (fb_info.bits_per_pixel / 8);
+        memcpy(mem + offset, row.data(), bytes);
+    });
+    return bytes * rows;
+}
@@ -2,6 +2,8 @@
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_image.h>
 #include <math.h>
+#include <string.h>
+#include <algorithm>
 #include <stdexcept>
 
 static void sdl_init() __attribute__((constructor));
@@ -32,40 +34,159 @@ Image::Image(const std::string& file) {
     }
 }
 
+Image::Image(size_t width, size_t height, std::vector<char> data):
+    img(std::move(data)), width(width), height(height) {
+    if (img.size() != 3*width*height)
+        throw std::invalid_argument("Wrong image data size!");
+}
+
+/**
+ *  Geometry of downscale: the number of old pixels per new pixel in each
+ *  direction, and the size of the new image, which has the new pixels
+ *  whose area starts inside the old one.
+ */
+struct DownscaleGeometry {
+    double ppc_row, ppc_column;
+    size_t width, height;
+
+    DownscaleGeometry(
+        size_t old_width, size_t old_height,
+        size_t w, size_t h, size_t pixel_width, size_t pixel_height
+    ) {
+        ppc_row = std::max(old_width/double(pixel_width*w), old_height/double(pixel_height*h))*pixel_height;
+        ppc_column = ppc_row*pixel_width/pixel_height;
+        width = height = 0;
+        if (ppc_row < 1 || ppc_column < 1) return;
+        while (width < w && ceil(width*ppc_column) < old_width) width++;
+        while (height < h && ceil(height*ppc_row) < old_height) height++;
+    }
+
+    /**
+     *  Old pixels [begin, end) of new pixels [x0, x1), or rows [y0, y1).
+     */
+    static size_t first(size_t x0, double ppc) { return ceil(x0*ppc); }
+    static size_t last(size_t x1, double ppc, size_t size) {
+        return std::min<size_t>(size, ceil(x1*ppc));
+    }
+};
+
+/**
+ *  Average of the old pixels of the new pixel (x, y).
+ */
+static void block_average(const Image& img, const DownscaleGeometry& geom, size_t x, size_t y, char* out) {
+    int red_sum = 0;
+    int green_sum = 0;
+    int blue_sum = 0;
+    int count = 0;
+    size_t i0 = DownscaleGeometry::first(x, geom.ppc_column);
+    size_t i1 = DownscaleGeometry::last(x+1, geom.ppc_column, img.width);
+    size_t j0 = DownscaleGeometry::first(y, geom.ppc_row);
+    size_t j1 = DownscaleGeometry::last(y+1, geom.ppc_row, img.height);
+    for (size_t j=j0; j<j1; j++) {
+        for (size_t i=i0; i<i1; i++) {
+            red_sum += img.r(i, j);
+            green_sum += img.g(i, j);
+            blue_sum += img.b(i, j);
+            count++;
+        }
+    }
+    out[0] = red_sum / count;
+    out[1] = green_sum / count;
+    out[2] = blue_sum / count;
+}
+
 void Image::downscale(size_t w, size_t h, size_t pixel_width, size_t pixel_height) {
-    double ppc_row = std::max(width/double(pixel_width*w), height/double(pixel_height*h))*pixel_height;
-    double ppc_column = ppc_row*pixel_width/pixel_height;
-    if (ppc_row < 1 || ppc_column < 1) return;
-    std::vector<char> img_data;
-    unsigned new_width = 0;
-    for (unsigned y=0; y<h; y++) {
-        if (ceil(y*ppc_row) > height) break;
-        new_width = 0;
-        for (unsigned x=0; x<w; x++) {
-            int red_sum = 0;
-            int green_sum = 0;
-            int blue_sum = 0;
-            int count = 0;
-            if (ceil(x*ppc_column) > width) break;
-            for (unsigned i=ceil(x*ppc_column); i<width && i<(x+1)*ppc_column; i++) {
-                for (unsigned j=ceil(y*ppc_row); j<height && j<(y+1)*ppc_row; j++) {
-                    red_sum += r(i, j);
-                    green_sum += g(i, j);
-                    blue_sum += b(i, j);
-                    count++;
+    DownscaleGeometry geom(width, height, w, h, pixel_width, pixel_height);
+    if (geom.width == 0 || geom.height == 0) return;
+    std::vector<char> img_data(3*geom.width*geom.height);
+    for (size_t y=0; y<geom.height; y++)
+        for (size_t x=0; x<geom.width; x++)
+            block_average(*this, geom, x, y, &img_data[3*(y*geom.width+x)]);
+    img = std::move(img_data);
+    width = geom.width;
+    height = geom.height;
+}
+
+Image Image::downscaled(
+    size_t w, size_t h, size_t pixel_width, size_t pixel_height,
+    const Image& previous_source, const Image& previous,
+    size_t tile, std::vector<bool>* changed
+) const {
+    DownscaleGeometry geom(width, height, w, h, pixel_width, pixel_height);
+    if (tile < 1) tile = 1;
+    size_t tiles_x = (geom.width + tile-1) / tile;
+    size_t tiles_y = (geom.height + tile-1) / tile;
+    if (changed) changed->assign(tiles_x*tiles_y, true);
+    if (geom.width == 0 || geom.height == 0) return *this;
+    bool reuse = previous_source.width == width && previous_source.height == height &&
+        previous.width == geom.width && previous.height == geom.height;
+    std::vector<char> img_data(3*geom.width*geom.height);
+    for (size_t ty=0; ty<tiles_y; ty++) {
+        size_t y0 = ty*tile, y1 = std::min(geom.height, y0+tile);
+        size_t j0 = DownscaleGeometry::first(y0, geom.ppc_row);
+        size_t j1 = DownscaleGeometry::last(y1, geom.ppc_row, height);
+        for (size_t tx=0; tx<tiles_x; tx++) {
+            size_t x0 = tx*tile, x1 = std::min(geom.width, x0+tile);
+            size_t i0 = DownscaleGeometry::first(x0, geom.ppc_column);
+            size_t i1 = DownscaleGeometry::last(x1, geom.ppc_column, width);
+            // memcmp is vectorized, and stops at the first difference.
+            bool same = reuse;
+            for (size_t j=j0; same && j<j1; j++) {
+                size_t offset = 3*(j*width+i0);
+                same = memcmp(&img[offset], previous_source.data()+offset, 3*(i1-i0)) == 0;
+            }
+            if (changed) (*changed)[ty*tiles_x+tx] = !same;
+            for (size_t y=y0; y<y1; y++) {
+                char* out = &img_data[3*(y*geom.width+x0)];
+                if (same) {
+                    memcpy(out, previous.data()+3*(y*geom.width+x0), 3*(x1-x0));
+                    continue;
                 }
+                for (size_t x=x0; x<x1; x++)
+                    block_average(*this, geom, x, y, out+3*(x-x0));
             }
-            if (count == 0) continue;
-            red_sum /= count;
-            green_sum /= count;
-            blue_sum /= count;
-            img_data.push_back(red_sum);
-            img_data.push_back(green_sum);
-            img_data.push_back(blue_sum);
-            new_width++;
         }
     }
+    return Image(geom.width, geom.height, std::move(img_data));
+}
+
+Image Image::sampled(size_t w, size_t h, size_t pixel_width, size_t pixel_height, size_t block) const {
+    DownscaleGeometry geom(width, height, w, h, pixel_width, pixel_height);
+    if (geom.width == 0 || geom.height == 0) return *this;
+    if (block < 1) block = 1;
+    double ppc_row = geom.ppc_row, ppc_column = geom.ppc_column;
+    size_t new_width = geom.width, new_height = geom.height;
+    std::vector<char> img_data(3*new_width*new_height);
+    for (size_t y=0; y<new_height; y++) {
+        size_t by = y / block * block;
+        double cy = (by + std::min(block, new_height-by)/2.0) * ppc_row;
+        size_t j = std::min<size_t>(cy, height-1);
+        for (size_t x=0; x<new_width; x++) {
+            size_t bx = x / block * block;
+            double cx = (bx + std::min(block, new_width-bx)/2.0) * ppc_column;
+            size_t i = std::min<size_t>(cx, width-1);
+            img_data[3*(y*new_width+x)] = r(i, j);
+            img_data[3*(y*new_width+x)+1] = g(i, j);
+            img_data[3*(y*new_width+x)+2] = b(i, j);
+        }
+    }
+    return Image(new_width, new_height, std::move(img_data));
+}
+
+void Image::upscale(size_t factor) {
+    if (factor <= 1) return;
+    std::vector<char> img_data;
+    img_data.reserve(img.size()*factor*factor);
+    std::vector<char> row;
+    for (size_t y=0; y<height; y++) {
+        row.clear();
+        for (size_t x=0; x<width; x++)
+            for (size_t i=0; i<factor; i++)
+                row.insert(row.end(), &img[3*(y*width+x)], &img[3*(y*width+x)+3]);
+        for (size_t i=0; i<factor; i++)
+            img_data.insert(img_data.end(), row.begin(), row.end());
+    }
     img = img_data;
-    width = new_width;
-    height = img.size()/(3*new_width);
+    width *= factor;
+    height *= factor;
 }
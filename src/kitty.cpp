@@ -0,0 +1,162 @@
+#include "kitty.hpp"
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdexcept>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/**
+ *  Maximum size of a chunk of base64 data in direct transmission.
+ */
+static const size_t chunk_size = 4096;
+
+std::string base64_encode(const char* data, size_t size) {
+    static const char table[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    const unsigned char* in = (const unsigned char*)data;
+    std::string out;
+    out.reserve((size+2)/3*4);
+    size_t i = 0;
+    for (; i+3<=size; i+=3) {
+        unsigned v = (in[i] << 16) | (in[i+1] << 8) | in[i+2];
+        out += table[v >> 18];
+        out += table[(v >> 12) & 63];
+        out += table[(v >> 6) & 63];
+        out += table[v & 63];
+    }
+    if (i+1 == size) {
+        unsigned v = in[i] << 16;
+        out += table[v >> 18];
+        out += table[(v >> 12) & 63];
+        out += "==";
+    } else if (i+2 == size) {
+        unsigned v = (in[i] << 16) | (in[i+1] << 8);
+        out += table[v >> 18];
+        out += table[(v >> 12) & 63];
+        out += table[(v >> 6) & 63];
+        out += '=';
+    }
+    return out;
+}
+
+std::string kitty_command(
+    const Image& img, int cols, int rows,
+    kitty_medium_t medium, const std::string& name
+) {
+    // q=2 suppresses the terminal's replies, which would otherwise end up
+    // in the input stream.
+    std::string keys = "a=T,f=24,q=2";
+    keys += ",s=" + std::to_string(img.width);
+    keys += ",v=" + std::to_string(img.height);
+    keys += ",c=" + std::to_string(cols);
+    keys += ",r=" + std::to_string(rows);
+    std::string out;
+    switch (medium) {
+    case kitty_shared_memory:
+    case kitty_temp_file:
+        out += "\033_G" + keys;
+        out += medium == kitty_shared_memory ? ",t=s;" : ",t=t;";
+        out += base64_encode(name.data(), name.size());
+        out += "\033\\";
+        break;
+    case kitty_direct: {
+        std::string payload = base64_encode(img.data(), 3*img.width*img.height);
+        for (size_t pos=0; pos<payload.size() || pos==0; pos+=chunk_size) {
+            bool more = pos + chunk_size < payload.size();
+            out += "\033_G";
+            if (pos == 0) out += keys + ",";
+            out += more ? "m=1;" : "m=0;";
+            out.append(payload, pos, chunk_size);
+            out += "\033\\";
+        }
+        break;
+    }
+    }
+    return out;
+}
+
+static void write_pixels(int fd, const Image& img) {
+    size_t size = 3*img.width*img.height;
+    const char* data = img.data();
+    while (size > 0) {
+        ssize_t written = write(fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error(std::string("Could not write pixel data: ") + strerror(errno));
+        }
+        data += written;
+        size -= written;
+    }
+}
+
+std::string kitty_store_shared_memory(const Image& img) {
+    static std::atomic<unsigned> counter(0);
+    std::string name = "/terminal-view-" + std::to_string(getpid()) + "-" + std::to_string(counter++);
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd == -1)
+        throw std::runtime_error("Could not create shared memory object " + name);
+    try {
+        write_pixels(fd, img);
+    } catch (...) {
+        close(fd);
+        shm_unlink(name.c_str());
+        throw;
+    }
+    close(fd);
+    return name;
+}
+
+std::string kitty_store_temp_file(const Image& img) {
+    // The terminal only deletes files whose name contains this string.
+    const char* tmpdir = getenv("TMPDIR");
+    std::string path = std::string(tmpdir ? tmpdir : "/tmp") + "/tty-graphics-protocol-XXXXXX";
+    int fd = mkstemp(&path[0]);
+    if (fd == -1)
+        throw std::runtime_error("Could not create temporary file " + path);
+    try {
+        write_pixels(fd, img);
+    } catch (...) {
+        close(fd);
+        unlink(path.c_str());
+        throw;
+    }
+    close(fd);
+    return path;
+}
+
+void kitty_release(const KittyObject& object) {
+    if (object.medium == kitty_shared_memory)
+        shm_unlink(object.name.c_str());
+    else if (object.medium == kitty_temp_file)
+        unlink(object.name.c_str());
+}
+
+std::string kitty_image(
+    const Image& img, int cols, int rows, kitty_medium_t preferred,
+    KittyObject* stored
+) {
+    KittyObject object;
+    switch (preferred) {
+    case kitty_shared_memory:
+        try {
+            object.name = kitty_store_shared_memory(img);
+            object.medium = kitty_shared_memory;
+            break;
+        } catch (std::runtime_error&) {}
+        // fallthrough
+    case kitty_temp_file:
+        try {
+            object.name = kitty_store_temp_file(img);
+            object.medium = kitty_temp_file;
+            break;
+        } catch (std::runtime_error&) {}
+        // fallthrough
+    case kitty_direct:
+        break;
+    }
+    if (stored) *stored = object;
+    return kitty_command(img, cols, rows, object.medium, object.name);
+}
@@ -1,11 +1,28 @@
+#include "adaptive.hpp"
+#include "batch.hpp"
+#include "daemon.hpp"
+#include "dither.hpp"
+#include "event_loop.hpp"
+#include "framebuffer.hpp"
 #include "image.hpp"
+#include "kitty.hpp"
+#include "probe.hpp"
+#include "render.hpp"
+#include "renderer.hpp"
+#include "sixel.hpp"
+#include "stats.hpp"
+#include "stream_writer.hpp"
 #include "terminal.hpp"
 #include <string.h>
 #include <stdlib.h>
 #include <vector>
-#include <iostream>
 #include <unistd.h>
-#include <chrono>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <termios.h>
+#include <thread>
 
 Terminal::term_type_t detect_term_type() {
     char* TERM = getenv("TERM");
@@ -43,11 +60,41 @@ Terminal::term_colors_t detect_term_colors() {
     return Terminal::ansi;
 }
 
+bool parse_size(const char* arg, int& w, int& h) {
+    char* pos;
+    w = strtol(arg, &pos, 10);
+    if (*pos != 'x') return false;
+    h = strtol(pos+1, &pos, 10);
+    return !*pos && w > 0 && h > 0;
+}
+
 int main(int argc, char** argv) {
     std::vector<char*> other_args;
     Terminal::term_type_t type = Terminal::xterm;
     Terminal::term_colors_t colors = Terminal::ansi;
     long long interval = 1000000;
+    unsigned threads = 0;
+    bool print_stats = false;
+    const char* stats_file = nullptr;
+    const char* batch_dir = nullptr;
+    const char* daemon_path = nullptr;
+    const char* daemon_socket = nullptr;
+    int width = 0, height = 0;
+    int cwidth = 0, cheight = 0;
+    const char* palette_file = nullptr;
+    bool use_probe_cache = true;
+    // Output backend: colored glyphs in cells, or pixels with the kitty
+    // graphics protocol, sixels or the framebuffer.
+    enum {cells, kitty, sixel, framebuffer} backend = cells;
+    const char* fb_path = nullptr;
+    int fb_width = 0, fb_height = 0;
+    unsigned sixel_colors = 256;
+    // Shared memory only works if the terminal runs on this machine.
+    kitty_medium_t kitty_medium = getenv("SSH_CONNECTION") ? kitty_direct : kitty_shared_memory;
+    bool blend = true;
+    bool progressive = false;
+    dither_t dither_method = no_dither;
+    double adaptive_budget = 0;
     bool found_term_type = false;
     bool found_term_colors = false;
     for (int i=1; i<argc; i++) {
@@ -66,6 +113,36 @@ int main(int argc, char** argv) {
         } else if (strcmp(argv[i], "--truecolor") == 0) {
             found_term_colors = true;
             colors = Terminal::truecolor;
+        } else if (strcmp(argv[i], "--adaptive") == 0) {
+            if (i == argc-1) {
+                fprintf(stderr, "No argument given for --adaptive!\n");
+                return 1;
+            }
+            char* pos;
+            adaptive_budget = strtod(argv[i+1], &pos);
+            if (*pos || adaptive_budget <= 0) {
+                fprintf(stderr, "Invalid frame time given!\n");
+                return 1;
+            }
+            i++;
+        } else if (strcmp(argv[i], "--dither") == 0) {
+            if (i == argc-1) {
+                fprintf(stderr, "No argument given for --dither!\n");
+                return 1;
+            }
+            i++;
+            if (strcmp(argv[i], "none") == 0) dither_method = no_dither;
+            else if (strcmp(argv[i], "bayer") == 0) dither_method = bayer_dither;
+            else if (strcmp(argv[i], "blue-noise") == 0) dither_method = blue_noise_dither;
+            else if (strcmp(argv[i], "diffusion") == 0) dither_method = diffusion_dither;
+            else {
+                fprintf(stderr, "Invalid dithering method %s!\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--progressive") == 0) {
+            progressive = true;
+        } else if (strcmp(argv[i], "--no-blend") == 0) {
+            blend = false;
         } else if (strcmp(argv[i], "--interval") == 0) {
             if (i == argc-1) {
                 fprintf(stderr, "No argument given for --interval!\n");
@@ -78,6 +155,123 @@ int main(int argc, char** argv) {
                 return 1;
             }
             i++;
+        } else if (strcmp(argv[i], "--threads") == 0) {
+            if (i == argc-1) {
+                fprintf(stderr, "No argument given for --threads!\n");
+                return 1;
+            }
+            char* pos;
+            long val = strtol(argv[i+1], &pos, 10);
+            if (*pos || val < 0) {
+                fprintf(stderr, "Invalid number of threads given!\n");
+                return 1;
+            }
+            threads = val;
+            i++;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            print_stats = true;
+        } else if (strcmp(argv[i], "--stats-file") == 0) {
+            if (i == argc-1) {
+                fprintf(stderr, "No argument given for --stats-file!\n");
+                return 1;
+            }
+            print_stats = true;
+            stats_file = argv[++i];
+        } else if (strcmp(argv[i], "--batch") == 0) {
+            if (i == argc-1) {
+                fprintf(stderr, "No argument given for --batch!\n");
+                return 1;
+            }
+            batch_dir = argv[++i];
+        } else if (strcmp(argv[i], "--daemon") == 0) {
+            if (i == argc-1) {
+                fprintf(stderr, "No argument given for --daemon!\n");
+                return 1;
+            }
+            daemon_path = argv[++i];
+        } else if (strcmp(argv[i], "--daemon-socket") == 0) {
+            if (i == argc-1) {
+                fprintf(stderr, "No argument given for --daemon-socket!\n");
+                return 1;
+            }
+            daemon_socket = argv[++i];
+        } else if (strcmp(argv[i], "--size") == 0) {
+            if (i == argc-1) {
+                fprintf(stderr, "No argument given for --size!\n");
+                return 1;
+            }
+            if (!parse_size(argv[i+1], width, height)) {
+                fprintf(stderr, "Invalid size given!\n");
+                return 1;
+            }
+            i++;
+        } else if (strcmp(argv[i], "--cell-size") == 0) {
+            if (i == argc-1) {
+                fprintf(stderr, "No argument given for --cell-size!\n");
+                return 1;
+            }
+            if (!parse_size(argv[i+1], cwidth, cheight)) {
+                fprintf(stderr, "Invalid cell size given!\n");
+                return 1;
+            }
+            i++;
+        } else if (strcmp(argv[i], "--palette-file") == 0) {
+            if (i == argc-1) {
+                fprintf(stderr, "No argument given for --palette-file!\n");
+                return 1;
+            }
+            palette_file = argv[++i];
+        } else if (strcmp(argv[i], "--reprobe") == 0) {
+            use_probe_cache = false;
+        } else if (strcmp(argv[i], "--kitty") == 0) {
+            backend = kitty;
+        } else if (strcmp(argv[i], "--kitty-medium") == 0) {
+            if (i == argc-1) {
+                fprintf(stderr, "No argument given for --kitty-medium!\n");
+                return 1;
+            }
+            backend = kitty;
+            i++;
+            if (strcmp(argv[i], "shm") == 0) kitty_medium = kitty_shared_memory;
+            else if (strcmp(argv[i], "file") == 0) kitty_medium = kitty_temp_file;
+            else if (strcmp(argv[i], "direct") == 0) kitty_medium = kitty_direct;
+            else {
+                fprintf(stderr, "Invalid kitty medium %s!\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--framebuffer") == 0) {
+            if (i == argc-1) {
+                fprintf(stderr, "No argument given for --framebuffer!\n");
+                return 1;
+            }
+            backend = framebuffer;
+            fb_path = argv[++i];
+        } else if (strcmp(argv[i], "--framebuffer-size") == 0) {
+            if (i == argc-1) {
+                fprintf(stderr, "No argument given for --framebuffer-size!\n");
+                return 1;
+            }
+            if (!parse_size(argv[i+1], fb_width, fb_height)) {
+                fprintf(stderr, "Invalid framebuffer size given!\n");
+                return 1;
+            }
+            i++;
+        } else if (strcmp(argv[i], "--sixel") == 0) {
+            backend = sixel;
+        } else if (strcmp(argv[i], "--sixel-colors") == 0) {
+            if (i == argc-1) {
+                fprintf(stderr, "No argument given for --sixel-colors!\n");
+                return 1;
+            }
+            char* pos;
+            long val = strtol(argv[i+1], &pos, 10);
+            if (*pos || val < 1 || val > 256) {
+                fprintf(stderr, "Invalid number of sixel colors given!\n");
+                return 1;
+            }
+            backend = sixel;
+            sixel_colors = val;
+            i++;
         } else if (argv[i][0] == '-') {
             fprintf(stderr, "Unknown option %s!\n", argv[i]);
             return 1;
@@ -85,47 +279,413 @@ int main(int argc, char** argv) {
             other_args.emplace_back(argv[i]);
         }
     }
+    // Daemon mode: terminals are configured by each request.
+    if (daemon_path) {
+        try {
+            run_daemon(daemon_path, threads);
+        } catch (std::exception& e) {
+            fprintf(stderr, "%s\n", e.what());
+        }
+        return 1;
+    }
     if (other_args.size() < 1) {
         fprintf(stderr, "You need to specify at least an image to show!\n");
         return 1;
     }
+    auto write_stats = [&](const Stats& stats) {
+        FILE* f = stats_file ? fopen(stats_file, "w") : stderr;
+        if (f == NULL) {
+            fprintf(stderr, "Could not open %s!\n", stats_file);
+            return false;
+        }
+        fputs(stats.to_json().c_str(), f);
+        if (f != stderr) fclose(f);
+        return true;
+    };
+
+    // A palette file replaces all the terminal queries.
+    TermInfo palette;
+    if (palette_file) {
+        try {
+            palette = read_palette_file(palette_file);
+        } catch (std::exception& e) {
+            fprintf(stderr, "%s\n", e.what());
+            return 1;
+        }
+        if (cwidth == 0) {
+            cwidth = palette.cwidth;
+            cheight = palette.cheight;
+        }
+    }
+
+    // Batch mode: no tty is involved, the geometry must be given.
+    if (batch_dir) {
+        if (width == 0) {
+            fprintf(stderr, "You need to specify --size in batch mode!\n");
+            return 1;
+        }
+        if (cwidth == 0) {
+            cwidth = 8;
+            cheight = 16;
+        }
+        Renderer renderer(std::unique_ptr<Terminal>(new Terminal(
+            type, colors, width, height, cwidth, cheight, palette.colors, ycgco, blend
+        )), threads);
+        Stats stats;
+        stats.palette_time = renderer.terminal().palette_time;
+        stats.threads = renderer.pool().size();
+        std::vector<std::string> files(other_args.begin(), other_args.end());
+        size_t failed = render_batch(
+            renderer.terminal(), files, batch_dir, renderer.pool(), print_stats ? &stats : nullptr,
+            dither_method
+        );
+        if (print_stats && !write_stats(stats)) return 1;
+        return failed ? 1 : 0;
+    }
+
     if (!found_term_type) type = detect_term_type();
     if (!found_term_colors) colors = detect_term_colors();
-    Terminal term(type, colors);
+    // Pixel backends do not use the terminal palette.
+    if (backend != cells) colors = Terminal::truecolor;
+    bool adaptive = adaptive_budget > 0 && backend == cells;
+    if (progressive && (backend != cells || adaptive || daemon_socket)) {
+        fprintf(stderr, "--progressive only works with cells, without --adaptive and --daemon-socket!\n");
+        return 1;
+    }
 
-    auto last_time = std::chrono::high_resolution_clock::now();
-    bool first_image = true;
-    for (const auto& image: other_args) {
-        Image img{image};
-        // Image preparation
-        img.downscale(term.width, term.height, term.cwidth, term.cheight);
-        int start_row = (term.height-img.height)/2;
-        int start_col = (term.width-img.width)/2;
-        if (start_row < 0) start_row = 0;
-        if (start_col < 0) start_col = 0;
+    // Client mode: the daemon renders with a warm terminal and writes to
+    // our stdout, only the geometry and palette are obtained here.
+    if (daemon_socket) {
+        if (backend != cells || adaptive) {
+            fprintf(stderr, "The daemon only renders cells, without --adaptive!\n");
+            return 1;
+        }
+        Stats stats;
+        try {
+            auto probe_start = Stats::clock::now();
+            TermInfo info;
+            if (palette_file) {
+                // With a given size, no tty is needed at all.
+                if (width == 0) info = terminal_size();
+                info.colors = palette.colors;
+            } else {
+                info = probe_terminal(type, colors != Terminal::truecolor, use_probe_cache);
+            }
+            stats.probe_time = Stats::since(probe_start);
+            DaemonRequest request;
+            request.type = type;
+            request.colors = colors;
+            request.blend = blend;
+            request.dither = dither_method;
+            request.width = width ? width : info.width;
+            request.height = height ? height : info.height;
+            request.cwidth = cwidth ? cwidth : info.cwidth ? info.cwidth : 8;
+            request.cheight = cheight ? cheight : info.cheight ? info.cheight : 16;
+            // Missing colors are filled in the same way by every terminal,
+            // so the fingerprint only depends on what was probed.
+            request.palette = info.colors;
+            DaemonClient client(daemon_socket);
+            EventLoop loop(true);
+            run_slideshow(loop, other_args.size(), interval/1e6, [&](size_t i) {
+                char* path = realpath(other_args[i], nullptr);
+                request.image = path ? path : other_args[i];
+                free(path);
+            }, [&](size_t i, double, const Stats::clock::time_point* deadline) {
+                // The daemon does all the work, so the slide only appears
+                // once it replied: that is when the deadline is missed.
+                DaemonReply reply = client.render(request, STDOUT_FILENO);
+                if (!reply.ok) throw std::runtime_error(reply.error);
+                double deadline_miss = 0;
+                if (deadline && Stats::clock::now() > *deadline)
+                    deadline_miss = Stats::since(*deadline);
+                FrameStats frame;
+                frame.file = other_args[i];
+                frame.decode = reply.decode;
+                frame.downscale = reply.downscale;
+                frame.dither = reply.dither;
+                frame.render = reply.render;
+                frame.bytes = reply.bytes;
+                frame.deadline_miss = deadline_miss;
+                if (deadline_miss > 0) stats.deadline_misses++;
+                if (print_stats) stats.frames.push_back(frame);
+            });
+        } catch (std::exception& e) {
+            fprintf(stderr, "%s\n", e.what());
+            return 1;
+        }
+        if (print_stats && !write_stats(stats)) return 1;
+        return 0;
+    }
+    std::unique_ptr<Terminal> term_ptr;
+    std::unique_ptr<Framebuffer> fb;
+    std::unique_ptr<EventLoop> loop;
+    std::unique_ptr<Renderer> renderer;
+    TermInfo info;
+    double probe_time = 0;
+    try {
+        if (palette_file || adaptive) {
+            // The adaptive mode needs one terminal per color mode, so the
+            // probe results are kept to build them.
+            auto probe_start = Stats::clock::now();
+            if (palette_file) {
+                info = terminal_size();
+                info.colors = palette.colors;
+            } else {
+                info = probe_terminal(type, colors != Terminal::truecolor, use_probe_cache);
+            }
+            if (cwidth != 0) {
+                info.cwidth = cwidth;
+                info.cheight = cheight;
+            } else if (info.cwidth == 0) {
+                info.cwidth = 8;
+                info.cheight = 16;
+            }
+            probe_time = Stats::since(probe_start);
+            term_ptr.reset(new Terminal(
+                type, adaptive ? Terminal::truecolor : colors,
+                info.width, info.height, info.cwidth, info.cheight,
+                info.colors, ycgco, blend
+            ));
+        } else {
+            term_ptr.reset(new Terminal(type, colors, ycgco, blend, use_probe_cache));
+            probe_time = term_ptr->probe_time;
+        }
+        if (backend == framebuffer) {
+            // A given size means that the path is a stand-in for a device.
+            if (fb_width)
+                fb.reset(new Framebuffer(fb_path, FramebufferInfo::xrgb8888(fb_width, fb_height)));
+            else
+                fb.reset(new Framebuffer(fb_path));
+        }
+        if (backend == kitty) {
+            // Local media only work if the terminal can open them.
+            auto probe_start = Stats::clock::now();
+            kitty_medium = probe_kitty_medium(kitty_medium);
+            probe_time += Stats::since(probe_start);
+        }
+        // The loop blocks the termination signals, so it must be created
+        // before the renderer starts its threads.
+        loop.reset(new EventLoop(true));
+        renderer.reset(new Renderer(std::move(term_ptr), threads));
+        renderer->dither_method = dither_method;
+        renderer->temporal = backend == cells && !adaptive && !progressive;
+    } catch (std::exception& e) {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    Terminal& term = renderer->terminal();
+    ThreadPool& pool = renderer->pool();
+    Stats stats;
+    stats.probe_time = probe_time;
+    stats.palette_time = term.palette_time;
+    stats.threads = pool.size();
+
+    AdaptiveController controller(colors, adaptive_budget);
+    std::map<std::pair<Terminal::term_colors_t, bool>, std::unique_ptr<Terminal>> adaptive_terms;
+    auto adaptive_term = [&](const AdaptiveChoice& choice) -> Terminal& {
+        auto& t = adaptive_terms[std::make_pair(choice.colors, choice.blend)];
+        if (!t) {
+            t.reset(new Terminal(
+                type, choice.colors, info.width, info.height, info.cwidth, info.cheight,
+                info.colors, ycgco, choice.blend
+            ));
+            stats.palette_time += t->palette_time;
+        }
+        return *t;
+    };
 
-        std::string out;
-        for (unsigned y=0; y<img.height; y++) {
-            out += term.move_to(start_col, y+start_row);
-            for (unsigned x=0; x<img.width; x++)
-                out += term.approximate(img.r(x, y), img.g(x, y), img.b(x, y)).cell_string();
-            out += term.clear_color();
-        }
-        out += term.move_to(1, 1000);
+    // Frame being prepared or presented by the slideshow. In progressive
+    // mode, the downscaling of the image may still be running on refine.
+    struct Prepared {
+        std::unique_ptr<Image> img;
+        FrameStats frame;
+        int img_cols = 0, img_rows = 0;
+        Terminal* frame_term = nullptr;
+        AdaptiveChoice choice;
+        RenderOptions options;
+        std::unique_ptr<Image> preview;
+        std::thread refine;
+        double refine_downscale = 0;
+        ~Prepared() {
+            if (refine.joinable()) refine.join();
+        }
+    };
+    std::unique_ptr<Prepared> prepared;
+    // Last image drawn by the renderer, and its position.
+    std::unique_ptr<Image> on_screen;
+    int on_screen_col = 0, on_screen_row = 0;
+    // Object holding the pixels of the last kitty image.
+    KittyObject kitty_object;
 
-        if (first_image) {
-            first_image = false;
+    // Decoding and downscaling run in the background, while the previous
+    // image is on screen.
+    auto prepare = [&](size_t index) {
+        prepared.reset(new Prepared);
+        Prepared& p = *prepared;
+        FrameStats& frame = p.frame;
+        frame.file = other_args[index];
+        auto stage_start = Stats::clock::now();
+        p.img.reset(new Image(other_args[index]));
+        Image& img = *p.img;
+        frame.decode = Stats::since(stage_start);
+        // Image preparation
+        stage_start = Stats::clock::now();
+        p.frame_term = &term;
+        // Progressive mode: a preview with one sample per block of cells
+        // is drawn first, while the image is downscaled in the background.
+        if (progressive) {
+            p.preview.reset(new Image(img.sampled(term.width, term.height, term.cwidth, term.cheight, 4)));
+            p.img_cols = p.preview->width;
+            p.img_rows = p.preview->height;
+            p.refine = std::thread([&p, &term]() {
+                auto refine_start = Stats::clock::now();
+                p.img->downscale(term.width, term.height, term.cwidth, term.cheight);
+                p.refine_downscale = Stats::since(refine_start);
+            });
+        } else if (adaptive) {
+            p.choice = controller.choose(term.width, term.height);
+            p.frame_term = &adaptive_term(p.choice);
+            p.options.compact = true;
+            int scale = p.choice.scale;
+            img.downscale(
+                std::max(1, term.width/scale), std::max(1, term.height/scale),
+                term.cwidth*scale, term.cheight*scale
+            );
+            auto dither_start = Stats::clock::now();
+            dither(img, *p.frame_term, dither_method, pool);
+            frame.dither = Stats::since(dither_start);
+            img.upscale(scale);
+            p.img_cols = img.width;
+            p.img_rows = img.height;
+        } else if (backend != cells) {
+            img.downscale(term.width*term.cwidth, term.height*term.cheight, 1, 1);
+            p.img_cols = std::min<int>(term.width, (img.width+term.cwidth-1)/term.cwidth);
+            p.img_rows = std::min<int>(term.height, (img.height+term.cheight-1)/term.cheight);
         } else {
-            while (true) {
-                auto elapsed = std::chrono::high_resolution_clock::now() - last_time;
-                long long count = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
-                if (count > interval) break;
-                usleep(1000);
+            renderer->fit(img, term.width, term.height, &frame);
+            p.img_cols = img.width;
+            p.img_rows = img.height;
+        }
+        frame.downscale = Stats::since(stage_start) - frame.dither;
+    };
+
+    // Rows are written as soon as they are ready, while the following
+    // ones are computed.
+    auto present = [&](size_t, double deadline_miss, const Stats::clock::time_point*) {
+        Prepared& p = *prepared;
+        Image& img = *p.img;
+        FrameStats& frame = p.frame;
+        FrameStats* frame_stats = print_stats ? &frame : nullptr;
+        frame.deadline_miss = deadline_miss;
+        if (deadline_miss > 0) stats.deadline_misses++;
+        // Cursor positions are 1-based.
+        int start_row = std::max(0, (term.height-p.img_rows)/2) + 1;
+        int start_col = std::max(0, (term.width-p.img_cols)/2) + 1;
+        if (backend == framebuffer) {
+            // The console draws the text over the framebuffer, so the
+            // screen is cleared before the pixels are written.
+            auto stage_start = Stats::clock::now();
+            StreamWriter writer(STDOUT_FILENO, 1);
+            writer.submit(0, term.clear() + term.move_to(1, 1000));
+            writer.wait();
+            tcdrain(STDOUT_FILENO);
+            frame.bytes = fb->draw(img, (start_col-1)*term.cwidth, (start_row-1)*term.cheight, pool);
+            frame.write = frame.render = Stats::since(stage_start);
+        } else if (backend != cells) {
+            auto stage_start = Stats::clock::now();
+            KittyObject stored;
+            std::string out = term.clear() + term.move_to(start_col, start_row);
+            if (backend == kitty)
+                out += kitty_image(img, p.img_cols, p.img_rows, kitty_medium, &stored);
+            else
+                out += sixel_image(img, sixel_colors, pool);
+            out += term.move_to(1, 1000);
+            frame.render = Stats::since(stage_start);
+            frame.bytes = out.size();
+            stage_start = Stats::clock::now();
+            StreamWriter writer(STDOUT_FILENO, 1);
+            writer.submit(0, std::move(out));
+            writer.wait();
+            frame.write = Stats::since(stage_start);
+            if (backend == kitty) {
+                // Once this frame is read, the terminal is done with the
+                // previous object, if it ever opened it.
+                tcdrain(STDOUT_FILENO);
+                kitty_release(kitty_object);
+                kitty_object = stored;
+            }
+        } else if (p.preview) {
+            auto write_start = Stats::clock::now();
+            RenderOptions preview_options;
+            preview_options.compact = true;
+            stream_image(
+                term, *p.preview, start_col, start_row, pool, STDOUT_FILENO,
+                term.clear(), term.move_to(1, 1000), frame_stats, preview_options
+            );
+            p.refine.join();
+            frame.downscale += p.refine_downscale;
+            auto dither_start = Stats::clock::now();
+            dither(img, term, dither_method, pool);
+            frame.dither = Stats::since(dither_start);
+            FrameStats changes;
+            stream_changes(
+                term, img, *p.preview, start_col, start_row, pool, STDOUT_FILENO,
+                "", term.move_to(1, 1000), frame_stats ? &changes : nullptr
+            );
+            frame.approximate += changes.approximate;
+            frame.encode += changes.encode;
+            frame.render += changes.render;
+            frame.cache_hits += changes.cache_hits;
+            frame.cache_misses += changes.cache_misses;
+            frame.candidates += changes.candidates;
+            frame.bytes += changes.bytes;
+            frame.write = Stats::since(write_start);
+        } else {
+            auto write_start = Stats::clock::now();
+            if (!adaptive) {
+                // When the image on screen has the same size and position,
+                // as in a sequence of video frames, only the cells that
+                // changed are drawn.
+                bool redraw = on_screen && on_screen->width == img.width && on_screen->height == img.height &&
+                    on_screen_col == start_col && on_screen_row == start_row;
+                renderer->stream(
+                    img, start_col, start_row, STDOUT_FILENO,
+                    redraw ? "" : term.clear(), term.move_to(1, 1000), frame_stats,
+                    redraw ? on_screen.get() : nullptr
+                );
+                on_screen.reset(new Image(img));
+                on_screen_col = start_col;
+                on_screen_row = start_row;
+            } else {
+                // The stats are always collected, as the drain time is
+                // measured from the first write of rows: the time spent
+                // rendering them before is not part of it.
+                size_t bytes = stream_image(
+                    *p.frame_term, img, start_col, start_row, pool, STDOUT_FILENO,
+                    term.clear(), term.move_to(1, 1000), &frame, p.options
+                );
+                // Wait for the terminal to consume the frame, to
+                // measure how fast it drains.
+                tcdrain(STDOUT_FILENO);
+                double drain = Stats::since(write_start) - frame.first_write_start;
+                controller.record(p.choice, bytes, img.width*img.height, drain);
+                frame.mode = p.choice.mode_name();
+                frame.scale = p.choice.scale;
+                frame.drain_rate = controller.drain_rate();
             }
         }
+        if (print_stats) stats.frames.push_back(frame);
+    };
 
-        std::cout << term.clear() << out << std::flush;
-        last_time = std::chrono::high_resolution_clock::now();
+    try {
+        run_slideshow(*loop, other_args.size(), interval/1e6, prepare, present);
+    } catch (std::exception& e) {
+        prepared.reset();
+        kitty_release(kitty_object);
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
     }
-    usleep(interval);
+    prepared.reset();
+    kitty_release(kitty_object);
+    if (print_stats && !write_stats(stats)) return 1;
 }
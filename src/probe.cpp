@@ -0,0 +1,444 @@
+#include "probe.hpp"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdexcept>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <unistd.h>
+#include <chrono>
+#include <functional>
+#ifdef __linux__
+#include <linux/kd.h>
+#endif
+
+static const int default_cwidth = 8;
+static const int default_cheight = 16;
+
+static TermInfo size_from_fd(int fd) {
+    TermInfo info;
+    struct winsize ts;
+    if (ioctl(fd, TIOCGWINSZ, &ts) == -1)
+        throw std::runtime_error("Could not get terminal size!");
+    info.width = ts.ws_col;
+    info.height = ts.ws_row;
+    if (ts.ws_col && ts.ws_row && ts.ws_xpixel && ts.ws_ypixel) {
+        info.cwidth = ts.ws_xpixel / ts.ws_col;
+        info.cheight = ts.ws_ypixel / ts.ws_row;
+    }
+    return info;
+}
+
+TermInfo terminal_size() {
+    int fd = open("/dev/tty", O_RDWR | O_NOCTTY);
+    if (fd == -1)
+        throw std::runtime_error("This process has no controlling terminal!");
+    try {
+        TermInfo info = size_from_fd(fd);
+        close(fd);
+        return info;
+    } catch (...) {
+        close(fd);
+        throw;
+    }
+}
+
+static bool parse_color(const char* s, std::array<unsigned char, 3>& color) {
+    if (*s == '#') s++;
+    if (strlen(s) != 6) return false;
+    for (int c=0; c<3; c++) {
+        char hex[3] = {s[2*c], s[2*c+1], 0};
+        char* end;
+        color[c] = strtol(hex, &end, 16);
+        if (*end) return false;
+    }
+    return true;
+}
+
+TermInfo read_palette_file(const std::string& path) {
+    FILE* f = fopen(path.c_str(), "r");
+    if (f == NULL)
+        throw std::runtime_error("Could not open " + path);
+    TermInfo info;
+    char line[256];
+    int lineno = 0;
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+        line[strcspn(line, "\r\n")] = 0;
+        if (line[0] == 0 || line[0] == ';') continue;
+        std::array<unsigned char, 3> color;
+        char extra;
+        if (sscanf(line, "cell %dx%d%c", &info.cwidth, &info.cheight, &extra) == 2) {
+            if (info.cwidth > 0 && info.cheight > 0) continue;
+        } else if (parse_color(line, color) && info.colors.size() < 256) {
+            info.colors.push_back(color);
+            continue;
+        }
+        fclose(f);
+        throw std::runtime_error(path + ":" + std::to_string(lineno) + ": invalid line");
+    }
+    fclose(f);
+    return info;
+}
+
+bool write_palette_file(const std::string& path, const TermInfo& info) {
+    std::string tmp = path + ".tmp";
+    FILE* f = fopen(tmp.c_str(), "w");
+    if (f == NULL) return false;
+    if (info.cwidth && info.cheight)
+        fprintf(f, "cell %dx%d\n", info.cwidth, info.cheight);
+    for (const auto& c: info.colors)
+        fprintf(f, "#%02x%02x%02x\n", c[0], c[1], c[2]);
+    if (fclose(f) != 0) return false;
+    return rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+/**
+ *  Path of the cache file for the current terminal, or an empty string if
+ *  there is no cache directory.
+ */
+static std::string cache_path(int fd) {
+    std::string dir;
+    const char* xdg = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+    if (xdg && *xdg) dir = xdg;
+    else if (home && *home) dir = std::string(home) + "/.cache";
+    else return "";
+    mkdir(dir.c_str(), 0700);
+    dir += "/terminal-view";
+    mkdir(dir.c_str(), 0700);
+
+    // FNV-1a hash of the terminal identity.
+    std::string identity;
+    for (const char* var: {"TERM", "WINDOWID", "KITTY_WINDOW_ID"}) {
+        const char* val = getenv(var);
+        identity += std::string(var) + "=" + (val ? val : "") + "\n";
+    }
+    const char* tty = ttyname(fd);
+    identity += std::string("tty=") + (tty ? tty : "");
+    unsigned long long hash = 14695981039346656037ULL;
+    for (char c: identity) {
+        hash ^= (unsigned char)c;
+        hash *= 1099511628211ULL;
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx", hash);
+    return dir + name;
+}
+
+/**
+ *  Converts a color component of 1 to 4 hex digits to 8 bits.
+ */
+static int scale_component(const std::string& hex) {
+    if (hex.empty() || hex.size() > 4) return -1;
+    char* end;
+    long v = strtol(hex.c_str(), &end, 16);
+    if (*end) return -1;
+    long max = (1L << (4*hex.size())) - 1;
+    return (v * 255 + max/2) / max;
+}
+
+/**
+ *  State of the reply parser.
+ */
+struct Replies {
+    std::vector<bool> have_color;
+    std::vector<std::array<unsigned char, 3>> colors;
+    int window_w = 0, window_h = 0;
+    int cell_w = 0, cell_h = 0;
+    bool done = false;
+};
+
+/**
+ *  Parse an OSC 4 reply body: 4;<id>;rgb:<r>/<g>/<b>
+ */
+static void parse_osc(const std::string& body, Replies& replies) {
+    int id;
+    int len = 0;
+    if (sscanf(body.c_str(), "4;%d;rgb:%n", &id, &len) != 1 || len == 0) return;
+    if (id < 0 || id >= (int)replies.colors.size()) return;
+    std::string rest = body.substr(len);
+    size_t s1 = rest.find('/');
+    size_t s2 = s1 == std::string::npos ? s1 : rest.find('/', s1+1);
+    if (s2 == std::string::npos) return;
+    int r = scale_component(rest.substr(0, s1));
+    int g = scale_component(rest.substr(s1+1, s2-s1-1));
+    int b = scale_component(rest.substr(s2+1));
+    if (r < 0 || g < 0 || b < 0) return;
+    replies.colors[id] = {(unsigned char)r, (unsigned char)g, (unsigned char)b};
+    replies.have_color[id] = true;
+}
+
+/**
+ *  Consume all the complete replies at the start of buf.
+ */
+static void parse_replies(std::string& buf, Replies& replies) {
+    size_t pos = 0;
+    while (pos < buf.size()) {
+        if (buf[pos] != '\033') {
+            pos++;
+            continue;
+        }
+        if (pos+1 == buf.size()) break;
+        if (buf[pos+1] == ']') {
+            // OSC, terminated by BEL or ST.
+            size_t bel = buf.find('\007', pos+2);
+            size_t st = buf.find("\033\\", pos+2);
+            size_t end = std::min(bel, st);
+            if (end == std::string::npos) break;
+            parse_osc(buf.substr(pos+2, end-pos-2), replies);
+            pos = end + (end == bel ? 1 : 2);
+        } else if (buf[pos+1] == '[') {
+            // CSI, terminated by a byte in 0x40-0x7e.
+            size_t end = pos+2;
+            while (end < buf.size() && (buf[end] < 0x40 || buf[end] > 0x7e)) end++;
+            if (end == buf.size()) break;
+            std::string params = buf.substr(pos+2, end-pos-2);
+            int kind, h, w;
+            if (buf[end] == 't' && sscanf(params.c_str(), "%d;%d;%d", &kind, &h, &w) == 3) {
+                if (kind == 4) {
+                    replies.window_w = w;
+                    replies.window_h = h;
+                } else if (kind == 6) {
+                    replies.cell_w = w;
+                    replies.cell_h = h;
+                }
+            } else if (buf[end] == 'c' && !params.empty() && params[0] == '?') {
+                replies.done = true;
+            }
+            pos = end+1;
+        } else {
+            pos++;
+        }
+    }
+    buf.erase(0, pos);
+}
+
+/**
+ *  Send queries to the terminal, in non-canonical mode without echo, and
+ *  give what it replies to parse, which consumes the complete replies at
+ *  the start of the buffer and returns true once the last one came. Stops
+ *  after timeout seconds.
+ */
+static void exchange(
+    int fd, const std::string& queries, double timeout,
+    const std::function<bool(std::string&)>& parse
+) {
+    struct termios term, initial_term;
+    if (tcgetattr(fd, &initial_term) == -1) return;
+    term = initial_term;
+    term.c_lflag &= ~(ICANON | ECHO);
+    term.c_cc[VMIN] = 0;
+    term.c_cc[VTIME] = 0;
+    tcsetattr(fd, TCSANOW, &term);
+
+    size_t written = 0;
+    while (written < queries.size()) {
+        ssize_t ret = write(fd, queries.data()+written, queries.size()-written);
+        if (ret < 0 && errno != EINTR) break;
+        if (ret > 0) written += ret;
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(timeout);
+    std::string buf;
+    bool done = false;
+    while (!done) {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now()).count();
+        if (left <= 0) break;
+        struct pollfd pfd = {fd, POLLIN, 0};
+        int ret = poll(&pfd, 1, left);
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret <= 0) break;
+        char data[1024];
+        ssize_t len = read(fd, data, sizeof(data));
+        if (len < 0 && errno == EINTR) continue;
+        if (len <= 0) break;
+        buf.append(data, len);
+        done = parse(buf);
+    }
+    // Replies that come after the timeout would otherwise be read by the
+    // program as keys, or echoed once echo is restored.
+    tcflush(fd, TCIFLUSH);
+    tcsetattr(fd, TCSANOW, &initial_term);
+}
+
+/**
+ *  Send all the queries and collect the replies that arrive in time.
+ */
+static Replies query_terminal(int fd, bool query_colors, double timeout) {
+    Replies replies;
+    if (query_colors) {
+        replies.colors = Terminal::default_colors(Terminal::xterm, 16);
+        replies.have_color.resize(16, false);
+    }
+    std::string queries;
+    for (int i=0; query_colors && i<16; i++)
+        queries += "\033]4;" + std::to_string(i) + ";?\007";
+    queries += "\033[14t\033[16t\033[c";
+    exchange(fd, queries, timeout, [&](std::string& buf) {
+        parse_replies(buf, replies);
+        return replies.done;
+    });
+    return replies;
+}
+
+TermInfo probe_terminal(Terminal::term_type_t type, bool query_colors, bool use_cache, double timeout) {
+    int fd = open("/dev/tty", O_RDWR | O_NOCTTY);
+    if (fd == -1)
+        throw std::runtime_error("This process has no controlling terminal!");
+    TermInfo info;
+    try {
+        info = size_from_fd(fd);
+    } catch (...) {
+        close(fd);
+        throw;
+    }
+
+    if (type == Terminal::console) {
+        // Colors are fixed, and the cell size comes from the font.
+        info.colors = Terminal::default_colors(Terminal::console, 16);
+        info.cwidth = default_cwidth;
+        info.cheight = default_cheight;
+#ifdef __linux__
+        static char empty[512*32*8];
+        struct consolefontdesc font;
+        font.charcount = sizeof(empty)/(32*8);
+        font.chardata = empty;
+        if (ioctl(fd, GIO_FONTX, &font) != -1)
+            info.cheight = font.charheight;
+#endif
+        close(fd);
+        return info;
+    }
+
+    std::string cache = use_cache ? cache_path(fd) : "";
+    if (!cache.empty()) {
+        try {
+            TermInfo cached = read_palette_file(cache);
+            if (cached.cwidth && (!query_colors || cached.colors.size() >= 16)) {
+                info.cwidth = cached.cwidth;
+                info.cheight = cached.cheight;
+                info.colors = cached.colors;
+                close(fd);
+                return info;
+            }
+        } catch (std::runtime_error&) {}
+    }
+
+    Replies replies = query_terminal(fd, query_colors, timeout);
+    close(fd);
+
+    if (replies.cell_w > 0 && replies.cell_h > 0) {
+        info.cwidth = replies.cell_w;
+        info.cheight = replies.cell_h;
+    } else if (replies.window_w > 0 && replies.window_h > 0 && info.width && info.height) {
+        info.cwidth = replies.window_w / info.width;
+        info.cheight = replies.window_h / info.height;
+    }
+    // The defaults are not cached, so that the cell size is probed again
+    // the next time.
+    bool complete = info.cwidth > 0 && info.cheight > 0;
+    if (!complete) {
+        info.cwidth = default_cwidth;
+        info.cheight = default_cheight;
+    }
+    info.colors = replies.colors;
+
+    // Only cache complete answers.
+    complete = complete && replies.done;
+    for (bool have: replies.have_color) complete = complete && have;
+    if (complete && !cache.empty()) write_palette_file(cache, info);
+    return info;
+}
+
+/**
+ *  Consume the complete kitty graphics replies (APC G i=<id>;OK or an
+ *  error message) at the start of buf, and return true after the DA1
+ *  reply. ok[id] is set for the successful ones.
+ */
+static bool parse_kitty_replies(std::string& buf, std::vector<bool>& ok) {
+    size_t pos = 0;
+    bool done = false;
+    while (pos < buf.size()) {
+        if (buf[pos] != '\033') {
+            pos++;
+            continue;
+        }
+        if (pos+1 == buf.size()) break;
+        if (buf[pos+1] == '_') {
+            size_t end = buf.find("\033\\", pos+2);
+            if (end == std::string::npos) break;
+            std::string body = buf.substr(pos+2, end-pos-2);
+            unsigned id;
+            int len = 0;
+            if (sscanf(body.c_str(), "Gi=%u%n", &id, &len) == 1 && id < ok.size() &&
+                body.compare(len, std::string::npos, ";OK") == 0)
+                ok[id] = true;
+            pos = end+2;
+        } else if (buf[pos+1] == '[') {
+            size_t end = pos+2;
+            while (end < buf.size() && (buf[end] < 0x40 || buf[end] > 0x7e)) end++;
+            if (end == buf.size()) break;
+            if (buf[end] == 'c' && end > pos+2 && buf[pos+2] == '?') done = true;
+            pos = end+1;
+        } else {
+            pos++;
+        }
+    }
+    buf.erase(0, pos);
+    return done;
+}
+
+kitty_medium_t probe_kitty_medium(kitty_medium_t preferred, double timeout) {
+    if (preferred == kitty_direct) return kitty_direct;
+    int fd = open("/dev/tty", O_RDWR | O_NOCTTY);
+    if (fd == -1) return kitty_direct;
+
+    // One black pixel is stored with each medium that can be, from the
+    // preferred one, and the terminal is asked whether it can load it.
+    // The query id is the index in media plus one, as the terminal does
+    // not reply to id 0, and DA1 is the sentinel.
+    Image pixel(1, 1, std::vector<char>(3, 0));
+    std::vector<KittyObject> media;
+    for (kitty_medium_t medium: {kitty_shared_memory, kitty_temp_file}) {
+        if (medium < preferred) continue;
+        KittyObject object;
+        object.medium = medium;
+        try {
+            if (medium == kitty_shared_memory)
+                object.name = kitty_store_shared_memory(pixel);
+            else
+                object.name = kitty_store_temp_file(pixel);
+        } catch (std::runtime_error&) {
+            continue;
+        }
+        media.push_back(object);
+    }
+    std::string queries;
+    for (size_t i=0; i<media.size(); i++) {
+        const std::string& name = media[i].name;
+        queries += "\033_Gi=" + std::to_string(i+1) + ",a=q,f=24,s=1,v=1,";
+        queries += media[i].medium == kitty_shared_memory ? "t=s;" : "t=t;";
+        queries += base64_encode(name.data(), name.size()) + "\033\\";
+    }
+    queries += "\033[c";
+    std::vector<bool> ok(media.size()+1, false);
+    exchange(fd, queries, timeout, [&](std::string& buf) {
+        return parse_kitty_replies(buf, ok);
+    });
+    close(fd);
+
+    // The terminal replied to all the queries, or never will: whatever
+    // it did not delete is removed here.
+    kitty_medium_t chosen = kitty_direct;
+    for (size_t i=media.size(); i-->0;) {
+        kitty_release(media[i]);
+        if (ok[i+1]) chosen = media[i].medium;
+    }
+    return chosen;
+}
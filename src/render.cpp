@@ -0,0 +1,377 @@
+#include "render.hpp"
+#include "stream_writer.hpp"
+#include <mutex>
+#include <stdexcept>
+#include <string.h>
+#include <vector>
+
+/**
+ *  Glyphs of the blend modes, as in TermColor::cell_string.
+ */
+static const char* const block_glyphs[] = {
+    " ", "\xe2\x96\x91", "\xe2\x96\x92", "\xe2\x96\x93", "\xe2\x96\x88"
+};
+static const size_t max_cell_bytes = 32;
+
+static inline void put(char*& p, const char* s) {
+    while (*s) *p++ = *s++;
+}
+
+static inline void put_number(char*& p, unsigned v) {
+    if (v >= 100) *p++ = '0' + v/100;
+    if (v >= 10) *p++ = '0' + v/10%10;
+    *p++ = '0' + v%10;
+}
+
+/**
+ *  Writes the same bytes as TermColor::cell_string, for a color of a
+ *  terminal with color mode C. Unless Blend is set, the color is known not
+ *  to be blended.
+ */
+template<Terminal::term_colors_t C, bool Blend>
+static inline void put_cell(char*& p, const TermColor& c) {
+    switch (C) {
+    case Terminal::truecolor:
+        put(p, "\033[38;2;");
+        put_number(p, c.r);
+        *p++ = ';';
+        put_number(p, c.g);
+        *p++ = ';';
+        put_number(p, c.b);
+        *p++ = 'm';
+        put(p, block_glyphs[TermColor::full]);
+        break;
+    case Terminal::ansi:
+        put(p, "\033[0m\033[3");
+        if (!Blend || c.type == TermColor::ansi) {
+            put_number(p, std::get<0>(c.ansi_code));
+            if (std::get<1>(c.ansi_code)) put(p, ";1");
+            *p++ = 'm';
+            put(p, block_glyphs[TermColor::full]);
+        } else {
+            put_number(p, std::get<1>(c.blended_ansi_code));
+            put(p, ";4");
+            put_number(p, std::get<3>(c.blended_ansi_code));
+            if (std::get<2>(c.blended_ansi_code)) put(p, ";1");
+            *p++ = 'm';
+            put(p, block_glyphs[std::get<0>(c.blended_ansi_code)]);
+        }
+        break;
+    case Terminal::extended:
+        put(p, "\033[38;5;");
+        if (!Blend || c.type == TermColor::extended) {
+            put_number(p, std::get<0>(c.extended_code));
+            *p++ = 'm';
+            put(p, block_glyphs[TermColor::full]);
+        } else {
+            put_number(p, std::get<1>(c.blended_extended_code));
+            put(p, "m\033[48;5;");
+            put_number(p, std::get<2>(c.blended_extended_code));
+            *p++ = 'm';
+            put(p, block_glyphs[std::get<0>(c.blended_extended_code)]);
+        }
+        break;
+    }
+}
+
+/**
+ *  render_rows and render_changed_rows, specialized for terminals with
+ *  kernel K, metric A, color mode C and blending Blend.
+ */
+template<Terminal::kernel_t K, dist_algo_t A, Terminal::term_colors_t C, bool Blend>
+struct RowKernel {
+    static void approximate_row(
+        Terminal& term, const Image& img, unsigned y,
+        std::vector<TermColor>& cells, FrameStats* stats
+    ) {
+        cells.clear();
+        for (unsigned x=0; x<img.width; x++)
+            cells.push_back(term.approximate_with<K, A>(img.r(x, y), img.g(x, y), img.b(x, y), stats));
+    }
+
+    /**
+     *  Count the lookups of a row that were not misses as cache hits.
+     *  misses is the miss count of stats before the row.
+     */
+    static void count_hits(FrameStats* stats, size_t lookups, unsigned long long misses) {
+        if (K != Terminal::search_kernel) return;
+        unsigned long long row_misses = stats->cache_misses - misses;
+        stats->cache_hits += lookups - row_misses;
+    }
+
+    /**
+     *  Append cells [begin, end) of a row to out.
+     */
+    static void encode(
+        const std::vector<TermColor>& cells, size_t begin, size_t end,
+        std::string& out, const RenderOptions& options
+    ) {
+        size_t used = out.size();
+        out.resize(used + (end-begin)*max_cell_bytes);
+        char* begin_ptr = &out[0] + used;
+        char* p = begin_ptr;
+        for (size_t x=begin; x<end; x++) {
+            if (options.compact && x > begin && cells[x].same_cell(cells[x-1]))
+                put(p, cells[x].glyph());
+            else
+                put_cell<C, Blend>(p, cells[x]);
+        }
+        out.resize(used + (p - begin_ptr));
+    }
+
+    static void render(
+        Terminal& term, const Image& img,
+        unsigned begin, unsigned end,
+        int start_col, int start_row,
+        std::string& out, FrameStats* stats,
+        const RenderOptions& options
+    ) {
+        std::vector<TermColor> cells;
+        cells.reserve(img.width);
+        for (unsigned y=begin; y<end; y++) {
+            auto start = Stats::clock::now();
+            unsigned long long misses = stats ? stats->cache_misses : 0;
+            approximate_row(term, img, y, cells, stats);
+            auto approximated = Stats::clock::now();
+            if (options.layout == absolute_rows)
+                out += term.move_to(start_col, y+start_row);
+            encode(cells, 0, cells.size(), out, options);
+            out += term.clear_color();
+            if (options.layout == inline_rows)
+                out += "\n";
+            if (stats) {
+                stats->approximate += std::chrono::duration<double>(approximated - start).count();
+                stats->encode += Stats::since(approximated);
+                stats->cells += cells.size();
+                count_hits(stats, cells.size(), misses);
+            }
+        }
+    }
+
+    static void render_changes(
+        Terminal& term, const Image& img, const Image& previous,
+        unsigned begin, unsigned end,
+        int start_col, int start_row,
+        std::string& out, FrameStats* stats,
+        const RenderOptions& options
+    ) {
+        std::vector<TermColor> cells, old_cells;
+        cells.reserve(img.width);
+        old_cells.reserve(img.width);
+        // Pixels of the same color are drawn in the same way, so only the
+        // ones that differ are approximated. The others get a placeholder
+        // that is the same cell in both rows.
+        const TermColor same(0, 0, 0);
+        for (unsigned y=begin; y<end; y++) {
+            auto start = Stats::clock::now();
+            unsigned long long misses = stats ? stats->cache_misses : 0;
+            const char* row = img.data() + 3*img.width*y;
+            const char* old_row = previous.data() + 3*img.width*y;
+            cells.clear();
+            old_cells.clear();
+            size_t count = 0;
+            if (memcmp(row, old_row, 3*img.width) != 0) {
+                for (unsigned x=0; x<img.width; x++) {
+                    if (memcmp(row+3*x, old_row+3*x, 3) == 0) {
+                        cells.push_back(same);
+                        old_cells.push_back(same);
+                        continue;
+                    }
+                    cells.push_back(term.approximate_with<K, A>(img.r(x, y), img.g(x, y), img.b(x, y), stats));
+                    old_cells.push_back(term.approximate_with<K, A>(previous.r(x, y), previous.g(x, y), previous.b(x, y), stats));
+                    count++;
+                }
+            }
+            auto approximated = Stats::clock::now();
+            bool changed = false;
+            size_t x = 0;
+            while (x < cells.size()) {
+                if (cells[x].same_cell(old_cells[x])) {
+                    x++;
+                    continue;
+                }
+                size_t run_end = x+1;
+                while (run_end < cells.size() && !cells[run_end].same_cell(old_cells[run_end]))
+                    run_end++;
+                out += term.move_to(start_col+x, y+start_row);
+                encode(cells, x, run_end, out, options);
+                changed = true;
+                x = run_end;
+            }
+            if (changed) out += term.clear_color();
+            if (stats) {
+                stats->approximate += std::chrono::duration<double>(approximated - start).count();
+                stats->encode += Stats::since(approximated);
+                stats->cells += count;
+                count_hits(stats, 2*count, misses);
+            }
+        }
+    }
+};
+
+/**
+ *  Call fn with the RowKernel that matches the terminal.
+ */
+template<Terminal::kernel_t K, dist_algo_t A, typename F>
+static void with_kernel(Terminal& term, F fn) {
+    // The closed forms never produce blended colors, and truecolor
+    // terminals have no palette at all.
+    switch (K) {
+    case Terminal::truecolor_kernel: return fn(RowKernel<K, A, Terminal::truecolor, false>());
+    case Terminal::xterm256_kernel: return fn(RowKernel<K, A, Terminal::extended, false>());
+    case Terminal::console16_kernel: return fn(RowKernel<K, A, Terminal::ansi, false>());
+    case Terminal::search_kernel: break;
+    }
+    if (term.colors == Terminal::ansi) {
+        if (term.blends()) fn(RowKernel<K, A, Terminal::ansi, true>());
+        else fn(RowKernel<K, A, Terminal::ansi, false>());
+    } else {
+        if (term.blends()) fn(RowKernel<K, A, Terminal::extended, true>());
+        else fn(RowKernel<K, A, Terminal::extended, false>());
+    }
+}
+
+template<dist_algo_t A, typename F>
+static void with_kernel(Terminal& term, F fn) {
+    switch (term.kernel()) {
+    case Terminal::truecolor_kernel: return with_kernel<Terminal::truecolor_kernel, A>(term, fn);
+    case Terminal::search_kernel: return with_kernel<Terminal::search_kernel, A>(term, fn);
+    case Terminal::xterm256_kernel: return with_kernel<Terminal::xterm256_kernel, A>(term, fn);
+    case Terminal::console16_kernel: return with_kernel<Terminal::console16_kernel, A>(term, fn);
+    }
+}
+
+template<typename F>
+static void with_kernel(Terminal& term, F fn) {
+    switch (term.algorithm()) {
+    case ycgco: return with_kernel<ycgco>(term, fn);
+    }
+}
+
+void render_rows(
+    Terminal& term, const Image& img,
+    unsigned begin, unsigned end,
+    int start_col, int start_row,
+    std::string& out, FrameStats* stats,
+    const RenderOptions& options
+) {
+    with_kernel(term, [&](auto kernel) {
+        decltype(kernel)::render(term, img, begin, end, start_col, start_row, out, stats, options);
+    });
+}
+
+/**
+ *  Render all the rows of the image on the pool, calling emit(y, data) as
+ *  soon as row y is encoded, and collect the frame statistics. If previous
+ *  is not null, only the cells that differ from it are drawn.
+ */
+template<typename Emit>
+static void render_parallel(
+    Terminal& term, const Image& img, const Image* previous,
+    int start_col, int start_row,
+    ThreadPool& pool, FrameStats* stats,
+    const RenderOptions& options, Emit emit
+) {
+    auto start = Stats::clock::now();
+    std::vector<FrameStats> row_stats(stats ? img.height : 0);
+    // The kernel is selected once for the whole frame.
+    with_kernel(term, [&](auto kernel) {
+        pool.parallel_for(img.height, [&](size_t y) {
+            std::string row;
+            FrameStats* rs = stats ? &row_stats[y] : nullptr;
+            if (previous)
+                decltype(kernel)::render_changes(term, img, *previous, y, y+1, start_col, start_row, row, rs, options);
+            else
+                decltype(kernel)::render(term, img, y, y+1, start_col, start_row, row, rs, options);
+            emit(y, std::move(row));
+        });
+    });
+    if (stats) {
+        for (const auto& rs: row_stats) {
+            stats->approximate += rs.approximate;
+            stats->encode += rs.encode;
+            stats->cells += rs.cells;
+            stats->cache_hits += rs.cache_hits;
+            stats->cache_misses += rs.cache_misses;
+            stats->candidates += rs.candidates;
+        }
+        stats->render += Stats::since(start);
+    }
+}
+
+std::string render_image(
+    Terminal& term, const Image& img,
+    int start_col, int start_row,
+    ThreadPool& pool, FrameStats* stats,
+    const RenderOptions& options
+) {
+    std::vector<std::string> rows(img.height);
+    render_parallel(term, img, nullptr, start_col, start_row, pool, stats, options,
+        [&](size_t y, std::string&& row) { rows[y] = std::move(row); });
+    size_t total = 0;
+    for (const auto& row: rows) total += row.size();
+    std::string out;
+    out.reserve(total);
+    for (const auto& row: rows) out += row;
+    return out;
+}
+
+/**
+ *  Write the prefix, the rows of the frame as soon as they are ready, and
+ *  the suffix to fd.
+ */
+static size_t stream_frame(
+    Terminal& term, const Image& img, const Image* previous,
+    int start_col, int start_row,
+    ThreadPool& pool, int fd,
+    const std::string& prefix, const std::string& suffix,
+    FrameStats* stats, const RenderOptions& options
+) {
+    // Chunk 0 is the prefix, chunk y+1 is row y, the last is the suffix.
+    // The first write is the one of the first row, not of the prefix.
+    StreamWriter writer(fd, img.height+2, 1, options.cancel_fd);
+    size_t bytes = prefix.size() + suffix.size();
+    std::mutex bytes_mutex;
+    writer.submit(0, prefix);
+    render_parallel(term, img, previous, start_col, start_row, pool, stats, options,
+        [&](size_t y, std::string&& row) {
+            {
+                std::lock_guard<std::mutex> lck(bytes_mutex);
+                bytes += row.size();
+            }
+            writer.submit(y+1, std::move(row));
+        });
+    writer.submit(img.height+1, suffix);
+    writer.wait();
+    if (stats) {
+        stats->first_write_start = writer.first_write_start_time();
+        stats->first_write = writer.first_write_time();
+        stats->write = writer.last_write_time();
+        stats->bytes += bytes;
+    }
+    return bytes;
+}
+
+size_t stream_image(
+    Terminal& term, const Image& img,
+    int start_col, int start_row,
+    ThreadPool& pool, int fd,
+    const std::string& prefix, const std::string& suffix,
+    FrameStats* stats, const RenderOptions& options
+) {
+    return stream_frame(term, img, nullptr, start_col, start_row, pool, fd, prefix, suffix, stats, options);
+}
+
+size_t stream_changes(
+    Terminal& term, const Image& img, const Image& previous,
+    int start_col, int start_row,
+    ThreadPool& pool, int fd,
+    const std::string& prefix, const std::string& suffix,
+    FrameStats* stats, const RenderOptions& options
+) {
+    if (img.width != previous.width || img.height != previous.height)
+        throw std::invalid_argument("The previous image has a different size!");
+    RenderOptions changes_options = options;
+    changes_options.layout = absolute_rows;
+    return stream_frame(term, img, &previous, start_col, start_row, pool, fd, prefix, suffix, stats, changes_options);
+}
@@ -0,0 +1,90 @@
+#include "renderer.hpp"
+#include <string.h>
+#include <algorithm>
+#include <stdexcept>
+
+// The terminal is declared before the pool, so that probing is done before
+// any thread is started.
+Renderer::Renderer(
+    Terminal::term_type_t type, Terminal::term_colors_t colors,
+    dist_algo_t algo, bool blend, bool use_probe_cache, unsigned threads
+): term(new Terminal(type, colors, algo, blend, use_probe_cache)), workers(threads) {}
+
+Renderer::Renderer(std::unique_ptr<Terminal> term, unsigned threads):
+    term(std::move(term)), workers(threads) {
+    if (!this->term) throw std::invalid_argument("No terminal given to the renderer!");
+}
+
+void Renderer::fit_locked(Image& img, int cols, int rows, FrameStats* stats) {
+    auto stage_start = Stats::clock::now();
+    cols = std::max(cols, 1);
+    rows = std::max(rows, 1);
+    if (!temporal) {
+        img.downscale(cols, rows, term->cwidth, term->cheight);
+    } else {
+        // Without a previous frame, every tile is computed.
+        Image none(0, 0, {});
+        bool reuse = last_source && cols == last_cols && rows == last_rows;
+        std::vector<bool> changed;
+        Image cells = img.downscaled(
+            cols, rows, term->cwidth, term->cheight,
+            reuse ? *last_source : none, reuse ? *last_cells : none,
+            tile_size, &changed
+        );
+        if (stats && reuse) {
+            stats->tiles += changed.size();
+            stats->changed_tiles += std::count(changed.begin(), changed.end(), true);
+        }
+        last_source.reset(new Image(std::move(img)));
+        last_cells.reset(new Image(cells));
+        img = std::move(cells);
+        last_cols = cols;
+        last_rows = rows;
+    }
+    // Images with less than a pixel per cell are not downscaled, and are
+    // drawn with a pixel per cell: those that would still not fit are
+    // reduced to the rectangle, each pixel standing for a cell.
+    if (img.width > (size_t)cols || img.height > (size_t)rows)
+        img.downscale(cols, rows, 1, 1);
+    if (stats) stats->downscale += Stats::since(stage_start);
+    stage_start = Stats::clock::now();
+    dither(img, *term, dither_method, workers);
+    if (stats) stats->dither += Stats::since(stage_start);
+}
+
+void Renderer::fit(Image& img, int cols, int rows, FrameStats* stats) {
+    std::lock_guard<std::mutex> lock(mutex);
+    fit_locked(img, cols, rows, stats);
+}
+
+size_t Renderer::render(
+    const unsigned char* rgb, size_t width, size_t height, size_t stride,
+    int col, int row, int cols, int rows,
+    char* out, size_t capacity, FrameStats* stats
+) {
+    if (stride < 3*width)
+        throw std::invalid_argument("The row stride is smaller than the image width!");
+    std::vector<char> data(3*width*height);
+    for (size_t y=0; y<height; y++)
+        memcpy(data.data() + 3*width*y, rgb + stride*y, 3*width);
+    Image img(width, height, std::move(data));
+    std::lock_guard<std::mutex> lock(mutex);
+    fit_locked(img, cols, rows, stats);
+    int start_col = col + std::max(0, (cols - (int)img.width)/2);
+    int start_row = row + std::max(0, (rows - (int)img.height)/2);
+    std::string frame = render_image(*term, img, start_col, start_row, workers, stats, options);
+    if (frame.size() <= capacity)
+        memcpy(out, frame.data(), frame.size());
+    return frame.size();
+}
+
+size_t Renderer::stream(
+    const Image& img, int col, int row, int fd,
+    const std::string& prefix, const std::string& suffix,
+    FrameStats* stats, const Image* previous
+) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (previous)
+        return stream_changes(*term, img, *previous, col, row, workers, fd, prefix, suffix, stats, options);
+    return stream_image(*term, img, col, row, workers, fd, prefix, suffix, stats, options);
+}
@@ -0,0 +1,215 @@
+#include "simulator.hpp"
+#include <algorithm>
+#include <math.h>
+#include <stdlib.h>
+
+TerminalSimulator::TerminalSimulator(
+    int width, int height, const std::vector<std::array<unsigned char, 3>>& palette
+): palette(palette), cells(width*height, {{0, 0, 0}}), width(width), height(height) {
+    reset_colors();
+}
+
+void TerminalSimulator::reset_colors() {
+    fg_ansi = 7;
+    bold = false;
+    fg = palette.size() > 7 ? palette[7] : std::array<unsigned char, 3>{{0xff, 0xff, 0xff}};
+    bg = {{0, 0, 0}};
+}
+
+std::array<unsigned char, 3> TerminalSimulator::foreground() const {
+    if (fg_ansi < 0) return fg;
+    // Bold ANSI colors are shown with their bright version.
+    size_t idx = fg_ansi + (bold && fg_ansi < 8 ? 8 : 0);
+    return idx < palette.size() ? palette[idx] : fg;
+}
+
+void TerminalSimulator::apply_sgr(const std::vector<int>& params) {
+    auto color = [&](size_t& i) {
+        std::array<unsigned char, 3> c{{0, 0, 0}};
+        if (i+1 < params.size() && params[i+1] == 5 && i+2 < params.size()) {
+            if (params[i+2] >= 0 && params[i+2] < (int)palette.size()) c = palette[params[i+2]];
+            i += 2;
+        } else if (i+1 < params.size() && params[i+1] == 2 && i+4 < params.size()) {
+            for (int k=0; k<3; k++) c[k] = std::min(255, std::max(0, params[i+2+k]));
+            i += 4;
+        }
+        return c;
+    };
+    for (size_t i=0; i<params.size(); i++) {
+        int p = params[i];
+        if (p == 0) reset_colors();
+        else if (p == 1) bold = true;
+        else if (p == 22) bold = false;
+        else if (p >= 30 && p <= 37) fg_ansi = p-30;
+        else if (p >= 90 && p <= 97) fg_ansi = p-90+8;
+        else if (p >= 40 && p <= 47) bg = palette[p-40];
+        else if (p >= 100 && p <= 107) bg = palette[p-100+8];
+        else if (p == 38) {
+            fg = color(i);
+            fg_ansi = -1;
+        }
+        else if (p == 48) bg = color(i);
+        else if (p == 39) fg_ansi = 7;
+        else if (p == 49) bg = {{0, 0, 0}};
+    }
+}
+
+void TerminalSimulator::put_glyph(int quarters) {
+    if (y >= 0 && y < height && x >= 0 && x < width) {
+        auto f = foreground();
+        auto& c = cells[y*width+x];
+        for (int k=0; k<3; k++)
+            c[k] = sqrt(quarters*f[k]*f[k]/4 + (4-quarters)*bg[k]*bg[k]/4);
+    }
+    x++;
+}
+
+void TerminalSimulator::feed(const std::string& data) {
+    std::string buf = pending + data;
+    pending.clear();
+    size_t pos = 0;
+    while (pos < buf.size()) {
+        unsigned char c = buf[pos];
+        if (c == '\033') {
+            if (pos+1 >= buf.size()) break;
+            if (buf[pos+1] != '[') {
+                pos += 2;
+                continue;
+            }
+            size_t end = pos+2;
+            while (end < buf.size() && (buf[end] < 0x40 || buf[end] > 0x7e)) end++;
+            if (end >= buf.size()) break;
+            std::vector<int> params;
+            const char* p = buf.c_str() + pos+2;
+            const char* params_end = buf.c_str() + end;
+            while (p < params_end) {
+                char* next;
+                params.push_back(strtol(p, &next, 10));
+                p = next;
+                if (p < params_end && *p == ';') p++;
+                else if (p < params_end) break;
+            }
+            switch (buf[end]) {
+            case 'm':
+                if (params.empty()) params.push_back(0);
+                apply_sgr(params);
+                break;
+            case 'H':
+                y = std::max(1, params.size() > 0 ? params[0] : 1) - 1;
+                x = std::max(1, params.size() > 1 ? params[1] : 1) - 1;
+                break;
+            case 'J':
+                if (!params.empty() && params[0] == 2)
+                    std::fill(cells.begin(), cells.end(), std::array<unsigned char, 3>{{0, 0, 0}});
+                break;
+            }
+            pos = end+1;
+        } else if (c == '\n') {
+            y++;
+            x = 0;
+            pos++;
+        } else if (c == '\r') {
+            x = 0;
+            pos++;
+        } else if (c == ' ') {
+            put_glyph(0);
+            pos++;
+        } else if (c == 0xe2) {
+            // Block elements: U+2588 full block, U+2591-2593 shades.
+            if (pos+2 >= buf.size()) break;
+            unsigned char c2 = buf[pos+1], c3 = buf[pos+2];
+            int quarters = 4;
+            if (c2 == 0x96 && c3 == 0x91) quarters = 1;
+            else if (c2 == 0x96 && c3 == 0x92) quarters = 2;
+            else if (c2 == 0x96 && c3 == 0x93) quarters = 3;
+            put_glyph(quarters);
+            pos += 3;
+        } else if (c >= 0x20) {
+            // Other characters are counted as a full block.
+            put_glyph(4);
+            pos++;
+            while (pos < buf.size() && ((unsigned char)buf[pos] & 0xc0) == 0x80) pos++;
+        } else {
+            pos++;
+        }
+    }
+    pending = buf.substr(pos);
+}
+
+/**
+ *  Converts an sRGB color to CIE L*a*b* (D65 white point).
+ */
+static std::array<double, 3> to_lab(const std::array<unsigned char, 3>& c) {
+    double lin[3];
+    for (int k=0; k<3; k++) {
+        double v = c[k] / 255.0;
+        lin[k] = v <= 0.04045 ? v / 12.92 : pow((v + 0.055) / 1.055, 2.4);
+    }
+    double xyz[3] = {
+        (0.4124564*lin[0] + 0.3575761*lin[1] + 0.1804375*lin[2]) / 0.95047,
+        (0.2126729*lin[0] + 0.7151522*lin[1] + 0.0721750*lin[2]),
+        (0.0193339*lin[0] + 0.1191920*lin[1] + 0.9503041*lin[2]) / 1.08883
+    };
+    for (int k=0; k<3; k++)
+        xyz[k] = xyz[k] > 0.008856 ? cbrt(xyz[k]) : 7.787*xyz[k] + 16.0/116;
+    return {{116*xyz[1] - 16, 500*(xyz[0] - xyz[1]), 200*(xyz[1] - xyz[2])}};
+}
+
+Quality compare_quality(const Image& reference, const TerminalSimulator& sim, int start_col, int start_row) {
+    double sq_err = 0;
+    double de_sum = 0;
+    double de_max = 0;
+    size_t count = 0;
+    for (size_t y=0; y<reference.height; y++) {
+        for (size_t x=0; x<reference.width; x++) {
+            int cx = start_col + x, cy = start_row + y;
+            if (cx < 0 || cy < 0 || cx >= sim.width || cy >= sim.height) continue;
+            std::array<unsigned char, 3> ref{{reference.r(x, y), reference.g(x, y), reference.b(x, y)}};
+            const auto& shown = sim.cell(cx, cy);
+            for (int k=0; k<3; k++) {
+                double d = double(ref[k]) - shown[k];
+                sq_err += d*d;
+            }
+            auto a = to_lab(ref), b = to_lab(shown);
+            double de = sqrt((a[0]-b[0])*(a[0]-b[0]) + (a[1]-b[1])*(a[1]-b[1]) + (a[2]-b[2])*(a[2]-b[2]));
+            de_sum += de;
+            de_max = std::max(de_max, de);
+            count++;
+        }
+    }
+    Quality q{0, 0, 0, 0};
+    if (count == 0) return q;
+    auto psnr = [](double mse) { return mse == 0 ? 99 : 10*log10(255.0*255.0/mse); };
+    q.psnr = psnr(sq_err / (3*count));
+    q.delta_e = de_sum / count;
+    q.max_delta_e = de_max;
+
+    double smooth_err = 0;
+    size_t smooth_count = 0;
+    for (size_t y=0; y<reference.height; y++) {
+        for (size_t x=0; x<reference.width; x++) {
+            double ref[3] = {0, 0, 0}, shown[3] = {0, 0, 0};
+            int n = 0;
+            for (size_t j=(y ? y-1 : 0); j<=y+1 && j<reference.height; j++) {
+                for (size_t i=(x ? x-1 : 0); i<=x+1 && i<reference.width; i++) {
+                    int cx = start_col + i, cy = start_row + j;
+                    if (cx < 0 || cy < 0 || cx >= sim.width || cy >= sim.height) continue;
+                    const auto& c = sim.cell(cx, cy);
+                    ref[0] += reference.r(i, j);
+                    ref[1] += reference.g(i, j);
+                    ref[2] += reference.b(i, j);
+                    for (int k=0; k<3; k++) shown[k] += c[k];
+                    n++;
+                }
+            }
+            if (n == 0) continue;
+            for (int k=0; k<3; k++) {
+                double d = (ref[k] - shown[k]) / n;
+                smooth_err += d*d;
+            }
+            smooth_count++;
+        }
+    }
+    q.smooth_psnr = psnr(smooth_err / (3*smooth_count));
+    return q;
+}
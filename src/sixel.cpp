@@ -0,0 +1,228 @@
+#include "sixel.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+static const int hist_size = 1<<15;
+
+static inline int hist_index(unsigned char r, unsigned char g, unsigned char b) {
+    return ((r>>3)<<10) | ((g>>3)<<5) | (b>>3);
+}
+
+/**
+ *  Pixel count and sum of the RGB values of the pixels that fall in a
+ *  histogram bin.
+ */
+struct Bin {
+    unsigned long long count = 0, r = 0, g = 0, b = 0;
+};
+
+/**
+ *  A box of the median cut: a range of histogram bins, sorted along some
+ *  channel, with their pixel count and the extent of each channel.
+ */
+struct Box {
+    size_t begin, end;
+    unsigned long long count;
+    int min[3], max[3];
+    int longest() const {
+        int best = 0;
+        for (int c=1; c<3; c++)
+            if (max[c]-min[c] > max[best]-min[best]) best = c;
+        return best;
+    }
+    int extent() const { return max[longest()] - min[longest()]; }
+};
+
+static inline int bin_channel(int idx, int c) {
+    return (idx >> (10 - 5*c)) & 31;
+}
+
+static Box make_box(const std::vector<int>& bins, const std::vector<Bin>& hist, size_t begin, size_t end) {
+    Box box{begin, end, 0, {31, 31, 31}, {0, 0, 0}};
+    for (size_t i=begin; i<end; i++) {
+        box.count += hist[bins[i]].count;
+        for (int c=0; c<3; c++) {
+            box.min[c] = std::min(box.min[c], bin_channel(bins[i], c));
+            box.max[c] = std::max(box.max[c], bin_channel(bins[i], c));
+        }
+    }
+    return box;
+}
+
+SixelPalette sixel_quantize(const Image& img, unsigned max_colors, ThreadPool& pool) {
+    if (max_colors < 1 || max_colors > 256)
+        throw std::invalid_argument("Sixel palettes have between 1 and 256 colors!");
+    // One histogram per thread, each on a block of rows, merged afterwards.
+    size_t blocks = std::max<size_t>(1, std::min<size_t>(pool.size(), img.height));
+    std::vector<std::vector<Bin>> partial(blocks);
+    pool.parallel_for(blocks, [&](size_t blk) {
+        std::vector<Bin>& h = partial[blk];
+        h.resize(hist_size);
+        size_t end = img.height*(blk+1)/blocks;
+        for (size_t y=img.height*blk/blocks; y<end; y++) {
+            for (size_t x=0; x<img.width; x++) {
+                unsigned char r = img.r(x, y), g = img.g(x, y), b = img.b(x, y);
+                Bin& bin = h[hist_index(r, g, b)];
+                bin.count++;
+                bin.r += r;
+                bin.g += g;
+                bin.b += b;
+            }
+        }
+    });
+    std::vector<Bin> hist(hist_size);
+    for (const auto& h: partial) {
+        for (int i=0; i<hist_size; i++) {
+            hist[i].count += h[i].count;
+            hist[i].r += h[i].r;
+            hist[i].g += h[i].g;
+            hist[i].b += h[i].b;
+        }
+    }
+    std::vector<int> bins;
+    for (int i=0; i<hist_size; i++)
+        if (hist[i].count) bins.push_back(i);
+
+    SixelPalette palette;
+    palette.lut.resize(hist_size, 0);
+    if (bins.empty()) {
+        palette.colors.push_back({0, 0, 0});
+        return palette;
+    }
+
+    // Median cut: split the box with the most pixels among the ones that
+    // can be split, along its longest channel, at the median pixel.
+    std::vector<Box> boxes{make_box(bins, hist, 0, bins.size())};
+    while (boxes.size() < max_colors) {
+        int best = -1;
+        for (size_t i=0; i<boxes.size(); i++) {
+            if (boxes[i].extent() == 0) continue;
+            if (best == -1 || boxes[i].count > boxes[best].count) best = i;
+        }
+        if (best == -1) break;
+        Box box = boxes[best];
+        int c = box.longest();
+        std::sort(bins.begin()+box.begin, bins.begin()+box.end, [&](int a, int b) {
+            return bin_channel(a, c) < bin_channel(b, c);
+        });
+        unsigned long long acc = 0;
+        size_t mid = box.begin;
+        while (mid < box.end-1 && 2*(acc + hist[bins[mid]].count) <= box.count)
+            acc += hist[bins[mid++]].count;
+        if (mid == box.begin) mid++;
+        boxes[best] = make_box(bins, hist, box.begin, mid);
+        boxes.push_back(make_box(bins, hist, mid, box.end));
+    }
+
+    for (size_t i=0; i<boxes.size(); i++) {
+        Bin sum;
+        for (size_t j=boxes[i].begin; j<boxes[i].end; j++) {
+            const Bin& bin = hist[bins[j]];
+            sum.count += bin.count;
+            sum.r += bin.r;
+            sum.g += bin.g;
+            sum.b += bin.b;
+            palette.lut[bins[j]] = i;
+        }
+        palette.colors.push_back({
+            (unsigned char)(sum.r / sum.count),
+            (unsigned char)(sum.g / sum.count),
+            (unsigned char)(sum.b / sum.count)
+        });
+    }
+    return palette;
+}
+
+/**
+ *  Append a run of count copies of the sixel character c.
+ */
+static void append_run(std::string& out, char c, size_t count) {
+    if (count > 3) {
+        out += '!';
+        out += std::to_string(count);
+        out += c;
+    } else {
+        out.append(count, c);
+    }
+}
+
+/**
+ *  Encode the six rows starting at row y0. indices holds the palette index
+ *  of each pixel.
+ */
+static void encode_band(
+    const std::vector<unsigned char>& indices, size_t width, size_t height,
+    size_t y0, size_t colors, std::string& out
+) {
+    size_t rows = std::min<size_t>(6, height-y0);
+    // Leftmost and rightmost column in which each color appears.
+    std::vector<size_t> first(colors, width), last(colors, 0);
+    for (size_t dy=0; dy<rows; dy++) {
+        const unsigned char* row = &indices[(y0+dy)*width];
+        for (size_t x=0; x<width; x++) {
+            first[row[x]] = std::min(first[row[x]], x);
+            last[row[x]] = std::max(last[row[x]], x);
+        }
+    }
+    bool first_color = true;
+    for (size_t col=0; col<colors; col++) {
+        if (first[col] == width) continue;
+        if (!first_color) out += '$';
+        first_color = false;
+        out += '#';
+        out += std::to_string(col);
+        append_run(out, '?', first[col]);
+        char run_char = 0;
+        size_t run = 0;
+        for (size_t x=first[col]; x<=last[col]; x++) {
+            int bits = 0;
+            for (size_t dy=0; dy<rows; dy++)
+                if (indices[(y0+dy)*width+x] == col) bits |= 1 << dy;
+            char c = 63 + bits;
+            if (c != run_char) {
+                append_run(out, run_char, run);
+                run_char = c;
+                run = 0;
+            }
+            run++;
+        }
+        append_run(out, run_char, run);
+    }
+}
+
+std::string sixel_encode(const Image& img, const SixelPalette& palette, ThreadPool& pool) {
+    std::vector<unsigned char> indices(img.width * img.height);
+    pool.parallel_for(img.height, [&](size_t y) {
+        for (size_t x=0; x<img.width; x++)
+            indices[y*img.width+x] = palette.lut[hist_index(img.r(x, y), img.g(x, y), img.b(x, y))];
+    });
+    size_t band_count = (img.height + 5) / 6;
+    std::vector<std::string> bands(band_count);
+    pool.parallel_for(band_count, [&](size_t band) {
+        encode_band(indices, img.width, img.height, 6*band, palette.colors.size(), bands[band]);
+    });
+
+    // P2=1: pixels that are not set keep the background of the terminal.
+    std::string out = "\033P0;1;0q\"1;1;";
+    out += std::to_string(img.width) + ";" + std::to_string(img.height);
+    for (size_t i=0; i<palette.colors.size(); i++) {
+        out += "#" + std::to_string(i) + ";2";
+        for (int c=0; c<3; c++)
+            out += ";" + std::to_string((palette.colors[i][c] * 100 + 127) / 255);
+    }
+    size_t total = out.size() + band_count + 2;
+    for (const auto& band: bands) total += band.size();
+    out.reserve(total);
+    // A graphics newline after the last band would move the cursor below
+    // the image.
+    for (size_t band=0; band<band_count; band++) {
+        if (band) out += '-';
+        out += bands[band];
+    }
+    out += "\033\\";
+    return out;
+}
+
+std::string sixel_image(const Image& img, unsigned max_colors, ThreadPool& pool) {
+    return sixel_encode(img, sixel_quantize(img, max_colors, pool), pool);
+}
@@ -0,0 +1,67 @@
+#include "stats.hpp"
+#include <stdio.h>
+
+static std::string json_string(const std::string& s) {
+    std::string out = "\"";
+    for (char c: s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if ((unsigned char)c < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        } else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+static std::string json_number(double d) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.9g", d);
+    return buf;
+}
+
+std::string Stats::to_json() const {
+    std::string out = "{\n";
+    out += "  \"probe_time\": " + json_number(probe_time) + ",\n";
+    out += "  \"palette_time\": " + json_number(palette_time) + ",\n";
+    out += "  \"threads\": " + std::to_string(threads) + ",\n";
+    out += "  \"deadline_misses\": " + std::to_string(deadline_misses) + ",\n";
+    out += "  \"frames\": [";
+    for (size_t i=0; i<frames.size(); i++) {
+        const FrameStats& f = frames[i];
+        double avg_candidates = f.cache_misses ? double(f.candidates) / f.cache_misses : 0;
+        out += i ? ",\n    {" : "\n    {";
+        out += "\"file\": " + json_string(f.file);
+        out += ", \"decode\": " + json_number(f.decode);
+        out += ", \"downscale\": " + json_number(f.downscale);
+        out += ", \"dither\": " + json_number(f.dither);
+        out += ", \"approximate\": " + json_number(f.approximate);
+        out += ", \"encode\": " + json_number(f.encode);
+        out += ", \"render\": " + json_number(f.render);
+        out += ", \"write\": " + json_number(f.write);
+        out += ", \"first_write_start\": " + json_number(f.first_write_start);
+        out += ", \"first_write\": " + json_number(f.first_write);
+        out += ", \"cache_hits\": " + std::to_string(f.cache_hits);
+        out += ", \"cache_misses\": " + std::to_string(f.cache_misses);
+        out += ", \"avg_candidates\": " + json_number(avg_candidates);
+        out += ", \"cells\": " + std::to_string(f.cells);
+        out += ", \"bytes\": " + std::to_string(f.bytes);
+        out += ", \"deadline_miss\": " + json_number(f.deadline_miss);
+        if (f.tiles) {
+            out += ", \"tiles\": " + std::to_string(f.tiles);
+            out += ", \"changed_tiles\": " + std::to_string(f.changed_tiles);
+        }
+        if (!f.mode.empty()) {
+            out += ", \"mode\": " + json_string(f.mode);
+            out += ", \"scale\": " + std::to_string(f.scale);
+            out += ", \"drain_rate\": " + json_number(f.drain_rate);
+        }
+        out += "}";
+    }
+    out += frames.empty() ? "]\n}\n" : "\n  ]\n}\n";
+    return out;
+}
@@ -0,0 +1,116 @@
+#include "stream_writer.hpp"
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include <system_error>
+
+StreamWriter::StreamWriter(int fd, size_t chunk_count, size_t timed_chunk, int cancel_fd):
+    fd(fd), cancel_fd(cancel_fd), chunks(chunk_count), ready(chunk_count, false),
+    start(Stats::clock::now()), timed_chunk(timed_chunk) {
+    writer = std::thread([this]() { write_loop(); });
+}
+
+StreamWriter::~StreamWriter() {
+    if (writer.joinable()) {
+        {
+            // Make the writer thread give up on chunks that never came.
+            std::lock_guard<std::mutex> lck(mutex);
+            if (!error) error = ECANCELED;
+        }
+        cv.notify_all();
+        writer.join();
+    }
+}
+
+void StreamWriter::submit(size_t chunk, std::string data) {
+    {
+        std::lock_guard<std::mutex> lck(mutex);
+        chunks[chunk] = std::move(data);
+        ready[chunk] = true;
+    }
+    cv.notify_all();
+}
+
+bool StreamWriter::wait_writable() {
+    struct pollfd pfd[2] = {{fd, POLLOUT, 0}, {cancel_fd, POLLIN, 0}};
+    while (true) {
+        if (poll(pfd, cancel_fd == -1 ? 1 : 2, -1) == -1) {
+            if (errno == EINTR) continue;
+            // Let the write report what is wrong.
+            return true;
+        }
+        if (pfd[1].revents) return false;
+        if (pfd[0].revents) return true;
+    }
+}
+
+void StreamWriter::write_loop() {
+    std::vector<struct iovec> iov;
+    while (true) {
+        size_t first, last;
+        {
+            std::unique_lock<std::mutex> lck(mutex);
+            cv.wait(lck, [&]() {
+                return error || next_chunk == chunks.size() || ready[next_chunk];
+            });
+            if (error || next_chunk == chunks.size()) return;
+            first = next_chunk;
+            last = first;
+            iov.clear();
+            while (last < chunks.size() && ready[last] && iov.size() < IOV_MAX) {
+                if (!chunks[last].empty())
+                    iov.push_back({&chunks[last][0], chunks[last].size()});
+                last++;
+            }
+        }
+        // Chunks in [first, last) are not touched by other threads anymore.
+        double write_start = Stats::since(start);
+        size_t pos = 0;
+        while (pos < iov.size()) {
+            if (cancel_fd != -1 && !wait_writable()) {
+                std::lock_guard<std::mutex> lck(mutex);
+                error = ECANCELED;
+                break;
+            }
+            ssize_t written = writev(fd, &iov[pos], std::min<size_t>(iov.size()-pos, IOV_MAX));
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    // Non-blocking descriptor: sleep until it drains, which
+                    // the next iteration does anyway with cancel_fd.
+                    if (cancel_fd == -1) wait_writable();
+                    continue;
+                }
+                std::lock_guard<std::mutex> lck(mutex);
+                error = errno;
+                break;
+            }
+            while (pos < iov.size() && (size_t)written >= iov[pos].iov_len) {
+                written -= iov[pos].iov_len;
+                pos++;
+            }
+            if (pos < iov.size()) {
+                iov[pos].iov_base = (char*)iov[pos].iov_base + written;
+                iov[pos].iov_len -= written;
+            }
+        }
+        std::lock_guard<std::mutex> lck(mutex);
+        if (error) break;
+        if (first <= timed_chunk && timed_chunk < last) {
+            first_write_start = write_start;
+            first_write = Stats::since(start);
+        }
+        last_write = Stats::since(start);
+        for (size_t i=first; i<last; i++) std::string().swap(chunks[i]);
+        next_chunk = last;
+        if (next_chunk == chunks.size()) break;
+    }
+    cv.notify_all();
+}
+
+void StreamWriter::wait() {
+    writer.join();
+    if (error)
+        throw std::system_error(error, std::generic_category(), "Could not write output");
+}
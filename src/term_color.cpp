@@ -1,23 +1,26 @@
 #include "term_color.hpp"
 #include <math.h>
 #include <assert.h>
+#include <stdexcept>
 #define EMPTY_BLOCK   " "
 #define ONE_QUARTER   "\xe2\x96\x91"
 #define ONE_HALF      "\xe2\x96\x92"
 #define THREE_QUARTER "\xe2\x96\x93"
 #define FULL_BLOCK    "\xe2\x96\x88"
 
+static const char* block(TermColor::blend_mode_t mode) {
+    switch (mode) {
+    case TermColor::empty: return EMPTY_BLOCK;
+    case TermColor::one_quarter: return ONE_QUARTER;
+    case TermColor::one_half: return ONE_HALF;
+    case TermColor::three_quarter: return THREE_QUARTER;
+    case TermColor::full: return FULL_BLOCK;
+    }
+    assert(false);
+    return FULL_BLOCK;
+}
+
 std::string TermColor::cell_string() {
-    auto block = [](blend_mode_t mode) {
-        switch (mode) {
-        case empty: return EMPTY_BLOCK;
-        case one_quarter: return ONE_QUARTER;
-        case one_half: return ONE_HALF;
-        case three_quarter: return THREE_QUARTER;
-        case full: return FULL_BLOCK;
-        }
-        assert(false);
-    };
     std::string out;
     switch (type) {
     case ansi:
@@ -85,6 +88,26 @@ TermColor TermColor::blend(blend_mode_t mode, const TermColor& other) {
     }
 }
 
+const char* TermColor::glyph() const {
+    switch (type) {
+    case blended_ansi: return block(std::get<0>(blended_ansi_code));
+    case blended_extended: return block(std::get<0>(blended_extended_code));
+    default: return FULL_BLOCK;
+    }
+}
+
+bool TermColor::same_cell(const TermColor& other) const {
+    if (type != other.type) return false;
+    switch (type) {
+    case ansi: return ansi_code == other.ansi_code;
+    case blended_ansi: return blended_ansi_code == other.blended_ansi_code;
+    case extended: return extended_code == other.extended_code;
+    case blended_extended: return blended_extended_code == other.blended_extended_code;
+    case truecolor: return r == other.r && g == other.g && b == other.b;
+    }
+    return false;
+}
+
 bool TermColor::can_blend() {
     if (type == extended) return true;
     if (type == ansi) return !std::get<1>(ansi_code);
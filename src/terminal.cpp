@@ -1,15 +1,11 @@
 #include "terminal.hpp"
+#include "probe.hpp"
+#include "stats.hpp"
 #include <algorithm>
-#include <sys/stat.h>
-#include <sys/select.h>
-#include <fcntl.h>
-#include <termios.h>
-#include <sys/ioctl.h>
 #include <assert.h>
-#include <iostream>
-#ifdef __linux__
-#include <linux/kd.h>
-#endif
+#include <limits>
+#include <stdexcept>
+#include <stdint.h>
 
 std::array<unsigned char, 3> console_colors[] = {
     {0x00, 0x00, 0x00},
@@ -30,6 +26,25 @@ std::array<unsigned char, 3> console_colors[] = {
     {0xff, 0xff, 0xff}
 };
 
+std::array<unsigned char, 3> xterm_colors[] = {
+    {0x00, 0x00, 0x00},
+    {0xcd, 0x00, 0x00},
+    {0x00, 0xcd, 0x00},
+    {0xcd, 0xcd, 0x00},
+    {0x00, 0x00, 0xee},
+    {0xcd, 0x00, 0xcd},
+    {0x00, 0xcd, 0xcd},
+    {0xe5, 0xe5, 0xe5},
+    {0x7f, 0x7f, 0x7f},
+    {0xff, 0x00, 0x00},
+    {0x00, 0xff, 0x00},
+    {0xff, 0xff, 0x00},
+    {0x5c, 0x5c, 0xff},
+    {0xff, 0x00, 0xff},
+    {0x00, 0xff, 0xff},
+    {0xff, 0xff, 0xff}
+};
+
 std::array<unsigned char, 3> extended_colors[] = {
     {0x00, 0x00, 0x00},
     {0x00, 0x00, 0x5f},
@@ -273,168 +288,206 @@ std::array<unsigned char, 3> extended_colors[] = {
     {0xee, 0xee, 0xee}
 };
 
-std::vector<std::array<unsigned char, 3>> Terminal::get_colors_rgb(int start, int end) {
+Terminal::Terminal(
+    term_type_t type, term_colors_t colors, dist_algo_t algo,
+    bool blend, bool use_probe_cache
+): algo(algo), blend(blend), type(type), colors(colors) {
+    auto probe_start = Stats::clock::now();
+    TermInfo info = probe_terminal(type, colors != truecolor, use_probe_cache);
+    width = info.width;
+    height = info.height;
+    cwidth = info.cwidth;
+    cheight = info.cheight;
+    probe_time = Stats::since(probe_start);
+    init_palette(expand_colors(info.colors));
+}
+
+Terminal::Terminal(
+    term_type_t type, term_colors_t colors,
+    int width, int height, int cwidth, int cheight,
+    const std::vector<std::array<unsigned char, 3>>& palette,
+    dist_algo_t algo, bool blend
+): algo(algo), blend(blend), width(width), height(height), cwidth(cwidth), cheight(cheight),
+   type(type), colors(colors) {
+    if (width <= 0 || height <= 0 || cwidth <= 0 || cheight <= 0)
+        throw std::invalid_argument("Invalid terminal geometry!");
+    if (colors != truecolor)
+        init_palette(expand_colors(palette));
+}
+
+std::vector<std::array<unsigned char, 3>> Terminal::expand_colors(
+    const std::vector<std::array<unsigned char, 3>>& cols
+) {
+    int count = colors == extended ? 256 : 16;
+    auto res = default_colors(type, count);
+    for (unsigned i=0; i<cols.size() && i<res.size(); i++)
+        res[i] = cols[i];
+    return res;
+}
+
+std::vector<std::array<unsigned char, 3>> Terminal::default_colors(term_type_t type, int count) {
     std::vector<std::array<unsigned char, 3>> res;
-    if (start >= end) return res;
-    if (type == console) {
-        for (int i=start; i<16 && i<end; i++)
-            res.push_back(console_colors[i]);
-        // The console does not support extended colors, but if asked we
-        // output them anyway.
-        for (int i=16; i<end; i++)
-            res.push_back(extended_colors[i-16]);
-        return res;
+    for (int i=0; i<16 && i<count; i++)
+        res.push_back(type == console ? console_colors[i] : xterm_colors[i]);
+    for (int i=16; i<count; i++)
+        res.push_back(extended_colors[i-16]);
+    return res;
+}
+
+/**
+ *  Compact palette entry used while expanding the palette: the displayed
+ *  color, the blend mode (full for plain colors), and the foreground and
+ *  background terminal colors. ANSI colors are numbered 0-7, with bold
+ *  only allowed in the foreground.
+ */
+struct PaletteEntry {
+    unsigned char r, g, b;
+    unsigned char mode;
+    unsigned char fg, bg;
+    bool bold;
+};
+
+/**
+ *  Integer square root, equal to (int)sqrt(n).
+ */
+static unsigned isqrt(unsigned n) {
+    unsigned root = 0;
+    for (unsigned bit = 1u << 30; bit; bit >>= 2) {
+        if (n >= root + bit) {
+            n -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
     }
-    if (end > 16) {
-        res = get_colors_rgb(start, 16);
-        for (int i=16; i<end; i++)
-            res.push_back(extended_colors[i-16]);
-        return res;
+    return root;
+}
+
+/**
+ *  Add the blends of every pair of base colors to the palette, computed
+ *  like TermColor::blend. As there are only a few distinct channel values
+ *  among the base colors, the blended channels are looked up in tables
+ *  indexed by the blend mode and the positions of the two values among
+ *  the distinct ones. Bold ANSI colors can only be foregrounds.
+ */
+static void add_blends(std::vector<PaletteEntry>& palette, size_t base_count) {
+    std::array<int, 256> value_index;
+    value_index.fill(-1);
+    std::vector<unsigned> values;
+    for (size_t i=0; i<base_count; i++) {
+        for (unsigned v: {palette[i].r, palette[i].g, palette[i].b}) {
+            if (value_index[v] != -1) continue;
+            value_index[v] = values.size();
+            values.push_back(v);
+        }
     }
-    auto read_color = [](FILE* tty, int id) {
-        unsigned char r, g, b;
-        int read_id;
-        char r_buf[10], g_buf[10], b_buf[10];
-        int ret = fscanf(tty, "\033]4;%d;rgb:%4s/%4s/%4s\007", &read_id, r_buf, g_buf, b_buf);
-        if (ret != 4 || read_id != id)
-            throw std::logic_error("Could not read terminal color info!");
-        r_buf[2] = g_buf[2] = b_buf[2] = 0;
-        r = std::stoi(r_buf, 0, 16);
-        g = std::stoi(g_buf, 0, 16);
-        b = std::stoi(b_buf, 0, 16);
-        return std::array<unsigned char, 3>{r, g, b};
-    };
-    FILE* tty = fopen("/dev/tty", "r+");
-    if (tty == NULL)
-        throw std::runtime_error("This process has no controlling terminal!\n");
-    int fd = fileno(tty);
-    fd_set readset;
-    struct timeval time;
-    struct termios term, initial_term;
-    tcgetattr(fd, &initial_term);
-    term = initial_term;
-    term.c_lflag &=~ICANON;
-    term.c_lflag &=~ECHO;
-    tcsetattr(fd, TCSANOW, &term);
-    for (int i=start; i<end; i++) {
-        fprintf(tty, "\033]4;%d;?\007", i);
+    size_t n = values.size();
+    std::vector<unsigned char> table[3];
+    for (unsigned q=1; q<4; q++) {
+        table[q-1].resize(n*n);
+        for (size_t f=0; f<n; f++)
+            for (size_t b=0; b<n; b++)
+                table[q-1][f*n+b] = isqrt(q*values[f]*values[f]/4 + (4-q)*values[b]*values[b]/4);
     }
-    fflush(tty);
-    FD_ZERO(&readset);
-    FD_SET(fd, &readset);
-    time.tv_sec = 0;
-    time.tv_usec = 1000000;
-    if (select(fd + 1, &readset, NULL, NULL, &time) == 1) {
-        for (int i=start; i<end; i++) {
-            res.emplace_back(read_color(tty, i));
+    palette.reserve(base_count + 3*base_count*(base_count-1)/2);
+    for (size_t i=0; i<base_count; i++) {
+        for (size_t j=i+1; j<base_count; j++) {
+            const PaletteEntry* bg = &palette[i];
+            const PaletteEntry* fg = &palette[j];
+            if (bg->bold) std::swap(bg, fg);
+            if (bg->bold) continue;
+            PaletteEntry blended = {0, 0, 0, 0, fg->fg, bg->fg, fg->bold};
+            size_t ir = value_index[fg->r]*n + value_index[bg->r];
+            size_t ig = value_index[fg->g]*n + value_index[bg->g];
+            size_t ib = value_index[fg->b]*n + value_index[bg->b];
+            for (unsigned q=1; q<4; q++) {
+                blended.r = table[q-1][ir];
+                blended.g = table[q-1][ig];
+                blended.b = table[q-1][ib];
+                blended.mode = q;
+                palette.push_back(blended);
+            }
         }
-    } else {
-        throw std::logic_error("Could not read terminal color info!");
     }
-    tcsetattr(fd, TCSADRAIN, &initial_term);
-    return res;
 }
 
-Terminal::Terminal(term_type_t type, term_colors_t colors, dist_algo_t algo): algo(algo), type(type), colors(colors) {
-    FILE* tty = fopen("/dev/tty", "r+");
-    if (tty == NULL)
-        throw std::runtime_error("This process has no controlling terminal!\n");
-
-    // Detect terminal width and height
-    struct winsize ts;
-    if (ioctl(fileno(tty), TIOCGWINSZ, &ts) == -1)
-        throw std::runtime_error("Could not get terminal size!\n");
-    width = ts.ws_col;
-    height = ts.ws_row;
-
-    // Detect character size
-    switch (type) {
-    case console: {
-        cwidth = 8;
-#ifdef __linux__
-        char empty[512*32*8];
-        struct consolefontdesc font;
-        font.charcount = sizeof(empty)/(32*8);
-        font.chardata = empty;
-        if (ioctl(fileno(tty), GIO_FONTX, &font) == -1)
-            throw std::runtime_error("Cannot get font size!\n");
-        cheight = font.charheight;
-#else
-        cheight = 16;
-#endif
-        break;
-    }
-    case xterm: {
-        int w, h;
-        fd_set readset;
-        struct timeval time;
-        struct termios term, initial_term;
-        tcgetattr(fileno(tty), &initial_term);
-        term = initial_term;
-        term.c_lflag &=~ICANON;
-        term.c_lflag &=~ECHO;
-        tcsetattr(fileno(tty), TCSANOW, &term);
-        fprintf(tty, "\033[14t");
-        fflush(tty);
-        FD_ZERO(&readset);
-        FD_SET(fileno(tty), &readset);
-        time.tv_sec = 0;
-        time.tv_usec = 1000000;
-        if (select(fileno(tty) + 1, &readset, NULL, NULL, &time) == 1) {
-            if (fscanf(tty, "\033[4;%d;%dj", &h, &w) != 2)
-                throw std::runtime_error("Cannot get font size!\n");
-        } else {
-            throw std::runtime_error("Cannot get font size!\n");
+/**
+ *  Remove the entries with the same color as a previous one, keeping the
+ *  order, with an open addressing hash set of the colors.
+ */
+static void remove_duplicates(std::vector<PaletteEntry>& palette) {
+    size_t capacity = 1;
+    while (capacity < 2*palette.size()) capacity <<= 1;
+    std::vector<uint32_t> slots(capacity, 0xffffffff);
+    size_t count = 0;
+    for (size_t i=0; i<palette.size(); i++) {
+        uint32_t key = (palette[i].r << 16) | (palette[i].g << 8) | palette[i].b;
+        size_t slot = (key * 2654435761u) & (capacity-1);
+        bool found = false;
+        while (slots[slot] != 0xffffffff) {
+            if (slots[slot] == key) {
+                found = true;
+                break;
+            }
+            slot = (slot+1) & (capacity-1);
         }
-        tcsetattr(fileno(tty), TCSADRAIN, &initial_term);
-        cwidth = w / width;
-        cheight = h / height;
-        break;
-    }};
+        if (found) continue;
+        slots[slot] = key;
+        palette[count++] = palette[i];
+    }
+    palette.resize(count);
+}
 
-    // Populate the palette, if needed.
-    std::vector<TermColor> temp_palette;
+void Terminal::init_palette(const std::vector<std::array<unsigned char, 3>>& cols) {
+    auto start = Stats::clock::now();
+    std::vector<PaletteEntry> entries;
     switch (colors) {
     case ansi: {
-        auto cols = get_colors_rgb(0, 16);
+        if (cols.size() < 16)
+            throw std::invalid_argument("The ANSI palette needs 16 colors!");
         for (int i=0; i<8; i++) {
-            temp_palette.emplace_back(i, false, cols[i][0], cols[i][1], cols[i][2]);
-            temp_palette.emplace_back(i, true, cols[i+8][0], cols[i+8][1], cols[i+8][2]);
+            entries.push_back({cols[i][0], cols[i][1], cols[i][2], TermColor::full, (unsigned char)i, 0, false});
+            entries.push_back({cols[i+8][0], cols[i+8][1], cols[i+8][2], TermColor::full, (unsigned char)i, 0, true});
         }
         break;
     }
     case extended: {
-        auto cols = get_colors_rgb(0, 256);
-        for (int i=0; i<256; i++) {
-            temp_palette.emplace_back(i, cols[i][0], cols[i][1], cols[i][2]);
-        }
+        if (cols.size() < 256)
+            throw std::invalid_argument("The extended palette needs 256 colors!");
+        for (int i=0; i<256; i++)
+            entries.push_back({cols[i][0], cols[i][1], cols[i][2], TermColor::full, (unsigned char)i, 0, false});
         break;
     }
     case truecolor:
-        fclose(tty);
         return;
     };
-    fclose(tty);
-    for (unsigned i=0; i<temp_palette.size(); i++) {
-        color_palette.push_back(temp_palette[i]);
-        for (unsigned j=i+1; j<temp_palette.size(); j++) {
-            if (temp_palette[i].can_blend()) {
-                color_palette.push_back(temp_palette[i].blend(TermColor::one_quarter, temp_palette[j]));
-                color_palette.push_back(temp_palette[i].blend(TermColor::one_half, temp_palette[j]));
-                color_palette.push_back(temp_palette[i].blend(TermColor::three_quarter, temp_palette[j]));
-            }
-            else if (temp_palette[j].can_blend()) {
-                color_palette.push_back(temp_palette[j].blend(TermColor::one_quarter, temp_palette[i]));
-                color_palette.push_back(temp_palette[j].blend(TermColor::one_half, temp_palette[i]));
-                color_palette.push_back(temp_palette[j].blend(TermColor::three_quarter, temp_palette[i]));
-           }
-        }
+    if (!blend) {
+        // Check for the standard palettes, for which there is a closed form
+        // approximation.
+        if (colors == extended && std::equal(cols.begin()+16, cols.begin()+256, extended_colors))
+            approx_mode = xterm256;
+        if (colors == ansi && type == console && std::equal(cols.begin(), cols.begin()+16, console_colors))
+            approx_mode = console16;
+    }
+    if (blend) add_blends(entries, entries.size());
+    remove_duplicates(entries);
+    color_palette.reserve(entries.size());
+    for (const auto& e: entries) {
+        bool plain = e.mode == TermColor::full;
+        auto mode = (TermColor::blend_mode_t)e.mode;
+        if (colors == ansi && plain)
+            color_palette.emplace_back((char)e.fg, e.bold, e.r, e.g, e.b);
+        else if (colors == ansi)
+            color_palette.emplace_back(mode, (char)e.fg, e.bold, (char)e.bg, e.r, e.g, e.b);
+        else if (plain)
+            color_palette.emplace_back(e.fg, e.r, e.g, e.b);
+        else
+            color_palette.emplace_back(mode, e.fg, e.bg, e.r, e.g, e.b);
     }
-    std::sort(color_palette.begin(), color_palette.end());
-    auto ptr = std::unique(color_palette.begin(), color_palette.end());
-    unsigned count = ptr - color_palette.begin();
-    while (count > color_palette.size()) color_palette.pop_back();
-    approx_cache.resize(256*256*256, -1);
+    if (approx_mode == search)
+        approx_cache.reset((std::atomic<int>*)calloc(256*256*256, sizeof(std::atomic<int>)));
+    if (approx_mode == search && !approx_cache)
+        throw std::bad_alloc();
     switch (colors) {
     case truecolor: assert(false);
     case ansi: bucket_width = 64; break;
@@ -448,6 +501,7 @@ Terminal::Terminal(term_type_t type, term_colors_t colors, dist_algo_t algo): al
         int ab = color_palette[i].b / bucket_width;
         buckets[(ar * bucket_count * bucket_count) | (ag * bucket_count) | ab].push_back(i);
     }
+    palette_time = Stats::since(start);
 }
 
 std::string Terminal::show_palette(int width, int line_width) {
@@ -467,12 +521,87 @@ std::string Terminal::show_palette(int width, int line_width) {
     return out;
 }
 
-TermColor Terminal::approximate(unsigned char r, unsigned char g, unsigned char b) {
-    if (colors == truecolor) return TermColor(r, g, b);
-    if (approx_cache[(r<<16) | (g<<8) | b] != -1)
-        return color_palette[approx_cache[(r<<16) | (g<<8) | b]];
-    std::vector<int> candidates;
+/**
+ *  Index of the nearest level of the xterm 6x6x6 color cube for each value
+ *  of a channel. Levels are 0, 95, 135, 175, 215, 255.
+ */
+struct CubeLevels {
+    unsigned char level[256] = {};
+    constexpr CubeLevels() {
+        const int values[6] = {0x00, 0x5f, 0x87, 0xaf, 0xd7, 0xff};
+        for (int v=0; v<256; v++) {
+            int best = 0;
+            for (int l=1; l<6; l++)
+                if (2*v >= values[l-1] + values[l]) best = l;
+            level[v] = best;
+        }
+    }
+};
+static constexpr CubeLevels cube_levels{};
+static constexpr unsigned char cube_values[6] = {0x00, 0x5f, 0x87, 0xaf, 0xd7, 0xff};
 
+template<dist_algo_t A>
+TermColor Terminal::approximate_xterm256(unsigned char r, unsigned char g, unsigned char b) {
+    // The metric mixes the channels, and weighs chroma more near grays, so
+    // the nearest level of each channel does not always give the nearest
+    // color. The levels next to them are compared as well.
+    int lr = cube_levels.level[r];
+    int lg = cube_levels.level[g];
+    int lb = cube_levels.level[b];
+    int best = 0;
+    double dist = std::numeric_limits<double>::max();
+    for (int ir=std::max(lr-1, 0); ir<=std::min(lr+1, 5); ir++) {
+        for (int ig=std::max(lg-1, 0); ig<=std::min(lg+1, 5); ig++) {
+            for (int ib=std::max(lb-1, 0); ib<=std::min(lb+1, 5); ib++) {
+                double cdist = color_distance<A>(r, g, b, cube_values[ir], cube_values[ig], cube_values[ib]);
+                if (cdist < dist) {
+                    best = 16 + 36*ir + 6*ig + ib;
+                    dist = cdist;
+                }
+            }
+        }
+    }
+    // Grays of the ramp 8, 18, ..., 238 around the average.
+    int avg = (r + g + b) / 3;
+    int gray_idx = avg < 8 ? 0 : std::min(22, (avg - 8) / 10);
+    for (int i=gray_idx; i<=gray_idx+1; i++) {
+        unsigned char gray = 8 + 10*i;
+        double cdist = color_distance<A>(r, g, b, gray, gray, gray);
+        if (cdist < dist) {
+            best = 232 + i;
+            dist = cdist;
+        }
+    }
+    if (best >= 232) {
+        unsigned char gray = 8 + 10*(best-232);
+        return TermColor((unsigned char)best, gray, gray, gray);
+    }
+    int cube = best - 16;
+    return TermColor(
+        (unsigned char)best, cube_values[cube/36], cube_values[cube/6%6], cube_values[cube%6]
+    );
+}
+
+template<dist_algo_t A>
+TermColor Terminal::approximate_console16(unsigned char r, unsigned char g, unsigned char b) {
+    int best = 0;
+    double dist = std::numeric_limits<double>::max();
+    for (int i=0; i<16; i++) {
+        const auto& c = console_colors[i];
+        double cdist = color_distance<A>(r, g, b, c[0], c[1], c[2]);
+        if (cdist < dist) {
+            best = i;
+            dist = cdist;
+        }
+    }
+    const auto& c = console_colors[best];
+    return TermColor((char)(best % 8), best >= 8, c[0], c[1], c[2]);
+}
+
+template<dist_algo_t A>
+TermColor Terminal::approximate_miss(unsigned char r, unsigned char g, unsigned char b, FrameStats* stats) {
+    auto& cached = approx_cache[(r<<16) | (g<<8) | b];
+    std::vector<int> candidates;
 
     int bucket_count = 256/bucket_width;
     int ar = r / bucket_width;
@@ -505,16 +634,38 @@ TermColor Terminal::approximate(unsigned char r, unsigned char g, unsigned char
     int best = -1;
     double dist = std::numeric_limits<double>::max();
     for (auto i: candidates) {
-        double cdist = color_distance(r, g, b, color_palette[i].r, color_palette[i].g, color_palette[i].b, algo);
+        double cdist = color_distance<A>(r, g, b, color_palette[i].r, color_palette[i].g, color_palette[i].b);
         if (cdist < dist) {
             best = i;
             dist = cdist;
         }
     }
-    approx_cache[(r<<16) | (g<<8) | b] = best;
+    cached.store(best+1, std::memory_order_relaxed);
+    if (stats) {
+        stats->cache_misses++;
+        stats->candidates += candidates.size();
+    }
     return color_palette[best];
 }
 
+template TermColor Terminal::approximate_xterm256<ycgco>(unsigned char, unsigned char, unsigned char);
+template TermColor Terminal::approximate_console16<ycgco>(unsigned char, unsigned char, unsigned char);
+template TermColor Terminal::approximate_miss<ycgco>(unsigned char, unsigned char, unsigned char, FrameStats*);
+
+TermColor Terminal::approximate(unsigned char r, unsigned char g, unsigned char b) {
+    switch (algo) {
+    case ycgco:
+        switch (kernel()) {
+        case truecolor_kernel: return approximate_with<truecolor_kernel, ycgco>(r, g, b);
+        case search_kernel: return approximate_with<search_kernel, ycgco>(r, g, b);
+        case xterm256_kernel: return approximate_with<xterm256_kernel, ycgco>(r, g, b);
+        case console16_kernel: return approximate_with<console16_kernel, ycgco>(r, g, b);
+        }
+    }
+    assert(false);
+    return TermColor(r, g, b);
+}
+
 std::string Terminal::move_to(int x, int y) {
     std::string ret = "\033[";
     ret += std::to_string(y);
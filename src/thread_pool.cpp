@@ -0,0 +1,76 @@
+#include "thread_pool.hpp"
+
+ThreadPool::ThreadPool(unsigned threads): next_index(0) {
+    if (threads == 0) threads = std::thread::hardware_concurrency();
+    if (threads == 0) threads = 1;
+    for (unsigned i=1; i<threads; i++)
+        workers.emplace_back([this]() { worker_loop(); });
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lck(mutex);
+        stopping = true;
+    }
+    work_cv.notify_all();
+    for (auto& w: workers) w.join();
+}
+
+void ThreadPool::run_job() {
+    while (true) {
+        size_t i = next_index.fetch_add(1, std::memory_order_relaxed);
+        if (i >= job_size) break;
+        try {
+            (*job)(i);
+        } catch (...) {
+            std::lock_guard<std::mutex> lck(mutex);
+            if (!error) error = std::current_exception();
+            next_index.store(job_size, std::memory_order_relaxed);
+        }
+    }
+}
+
+void ThreadPool::worker_loop() {
+    unsigned long seen = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lck(mutex);
+            work_cv.wait(lck, [&]() { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+        }
+        run_job();
+        {
+            std::lock_guard<std::mutex> lck(mutex);
+            busy--;
+        }
+        done_cv.notify_one();
+    }
+}
+
+void ThreadPool::parallel_for(size_t n, const std::function<void(size_t)>& fn) {
+    if (workers.empty() || n <= 1) {
+        for (size_t i=0; i<n; i++) fn(i);
+        return;
+    }
+    std::lock_guard<std::mutex> call(call_mutex);
+    {
+        std::lock_guard<std::mutex> lck(mutex);
+        job = &fn;
+        job_size = n;
+        next_index.store(0, std::memory_order_relaxed);
+        error = nullptr;
+        busy = workers.size();
+        generation++;
+    }
+    work_cv.notify_all();
+    run_job();
+    std::unique_lock<std::mutex> lck(mutex);
+    done_cv.wait(lck, [&]() { return busy == 0; });
+    job = nullptr;
+    if (error) {
+        std::exception_ptr e = error;
+        error = nullptr;
+        std::rethrow_exception(e);
+    }
+}
@@ -0,0 +1,45 @@
+#include "kitty.hpp"
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+/**
+ *  Compares the output of the kitty graphics encoder with captured
+ *  escape sequences, for each transmission medium.
+ */
+
+static int failures = 0;
+
+static void check(const char* name, const std::string& got, const std::string& expected) {
+    if (got == expected) return;
+    size_t pos = 0;
+    while (pos < got.size() && pos < expected.size() && got[pos] == expected[pos]) pos++;
+    fprintf(stderr, "FAIL %s: output differs at byte %zu of %zu (expected %zu bytes)\n",
+        name, pos, got.size(), expected.size());
+    failures++;
+}
+
+int main() {
+    check("base64 padding", base64_encode("a", 1) + base64_encode("ab", 2), "YQ==YWI=");
+    check("base64 empty", base64_encode("", 0), "");
+
+    Image red(1, 1, {(char)0xff, 0, 0});
+    check("direct single chunk", kitty_command(red, 1, 1, kitty_direct),
+        "\033_Ga=T,f=24,q=2,s=1,v=1,c=1,r=1,m=0;/wAA\033\\");
+
+    // 3600 bytes of pixels are 4800 base64 characters: a chunk of 4096
+    // and one of 704. Only the first one carries the keys.
+    Image black(40, 30, std::vector<char>(3*40*30, 0));
+    check("direct chunking", kitty_command(black, 5, 2, kitty_direct),
+        "\033_Ga=T,f=24,q=2,s=40,v=30,c=5,r=2,m=1;" + std::string(4096, 'A') + "\033\\"
+        "\033_Gm=0;" + std::string(704, 'A') + "\033\\");
+
+    check("shared memory", kitty_command(black, 5, 2, kitty_shared_memory, "/terminal-view-1-0"),
+        "\033_Ga=T,f=24,q=2,s=40,v=30,c=5,r=2,t=s;L3Rlcm1pbmFsLXZpZXctMS0w\033\\");
+    check("temp file", kitty_command(red, 3, 4, kitty_temp_file, "/tmp/tty-graphics-protocol-abc123"),
+        "\033_Ga=T,f=24,q=2,s=1,v=1,c=3,r=4,t=t;L3RtcC90dHktZ3JhcGhpY3MtcHJvdG9jb2wtYWJjMTIz\033\\");
+
+    if (failures) return 1;
+    printf("kitty_test: ok\n");
+    return 0;
+}
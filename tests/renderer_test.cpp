@@ -0,0 +1,80 @@
+#include "renderer.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+/**
+ *  Checks that Renderer::render only draws inside the rectangle it is
+ *  given, whatever the size of the image: every cursor movement goes to a
+ *  cell of the rectangle, and no row of cells goes past its right edge.
+ */
+
+static int failures = 0;
+
+static void check_inside(
+    size_t width, size_t height, int col, int row, int cols, int rows,
+    Terminal::term_colors_t colors
+) {
+    Renderer renderer(std::unique_ptr<Terminal>(new Terminal(
+        Terminal::xterm, colors, 120, 50, 8, 16
+    )), 1);
+    std::vector<unsigned char> rgb(3*width*height);
+    for (size_t i=0; i<rgb.size(); i++) rgb[i] = i*7;
+    size_t size = renderer.render(rgb.data(), width, height, 3*width, col, row, cols, rows, nullptr, 0);
+    std::string out(size, 0);
+    renderer.render(rgb.data(), width, height, 3*width, col, row, cols, rows, &out[0], out.size());
+
+    char name[128];
+    snprintf(name, sizeof(name), "%zux%zu in %dx%d at (%d,%d), %d colors",
+        width, height, cols, rows, col, row, (int)colors);
+    int x = 0, y = 0;
+    bool placed = false;
+    for (size_t i=0; i<out.size();) {
+        if (out[i] == '\033' && i+1 < out.size() && out[i+1] == '[') {
+            size_t end = i+2;
+            while (end < out.size() && (out[end] < 0x40 || out[end] > 0x7e)) end++;
+            if (end < out.size() && out[end] == 'H') {
+                if (sscanf(out.c_str()+i+2, "%d;%d", &y, &x) != 2 ||
+                    x < col || x >= col+cols || y < row || y >= row+rows) {
+                    fprintf(stderr, "FAIL %s: cursor moved to (%d,%d)\n", name, x, y);
+                    failures++;
+                    return;
+                }
+                placed = true;
+            }
+            i = end+1;
+            continue;
+        }
+        // Every other character starts a glyph, except UTF-8 continuation
+        // bytes.
+        if (((unsigned char)out[i] & 0xc0) != 0x80) {
+            if (!placed || x >= col+cols) {
+                fprintf(stderr, "FAIL %s: cell drawn at (%d,%d)\n", name, x, y);
+                failures++;
+                return;
+            }
+            x++;
+        }
+        i++;
+    }
+}
+
+int main() {
+    const Terminal::term_colors_t modes[] = {Terminal::ansi, Terminal::extended, Terminal::truecolor};
+    for (auto colors: modes) {
+        // Fewer pixels than cells, in one or both directions.
+        check_inside(30, 40, 1, 1, 40, 24, colors);
+        check_inside(1, 1, 1, 1, 1, 1, colors);
+        check_inside(5, 100, 3, 2, 10, 10, colors);
+        check_inside(100, 5, 3, 2, 10, 10, colors);
+        check_inside(30, 40, 7, 5, 40, 24, colors);
+        // More pixels than cells.
+        check_inside(640, 480, 1, 1, 40, 24, colors);
+        check_inside(640, 480, 11, 4, 17, 3, colors);
+        check_inside(2000, 50, 2, 2, 80, 20, colors);
+    }
+    if (failures) return 1;
+    printf("renderer_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,65 @@
+#include "thread_pool.hpp"
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+/**
+ *  Checks that exceptions thrown by a job, on the caller or on a worker,
+ *  come back out of parallel_for only once no call is running anymore,
+ *  and that the pool can still be used afterwards.
+ */
+
+static int failures = 0;
+
+static void check(const char* name, bool ok) {
+    if (ok) return;
+    fprintf(stderr, "FAIL %s\n", name);
+    failures++;
+}
+
+/**
+ *  Run a job whose every throw_at-th call throws, and check that the
+ *  exception came out after all the calls ended, and whether the indices
+ *  after the first throw were skipped.
+ */
+static void check_throw(ThreadPool& pool, const char* name, size_t n, size_t throw_at, bool skips) {
+    std::atomic<int> running(0);
+    std::atomic<size_t> calls(0);
+    std::string what;
+    try {
+        pool.parallel_for(n, [&](size_t i) {
+            running++;
+            calls++;
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+            running--;
+            if (i % throw_at == throw_at-1) throw std::runtime_error("index " + std::to_string(i));
+        });
+    } catch (std::runtime_error& e) {
+        what = e.what();
+    }
+    check(name, what.compare(0, 6, "index ") == 0);
+    check(name, running == 0);
+    check(name, !skips || calls < n);
+}
+
+int main() {
+    ThreadPool pool(4);
+    check_throw(pool, "throw on the last call", 200, 200, false);
+    check_throw(pool, "throw on some calls", 200, 37, true);
+    // Both the calling thread and the workers throw.
+    check_throw(pool, "throw on every call", 200, 1, true);
+
+    std::atomic<size_t> sum(0);
+    pool.parallel_for(1000, [&](size_t i) { sum += i; });
+    check("reuse after exceptions", sum == 999*1000/2);
+
+    ThreadPool inline_pool(1);
+    check_throw(inline_pool, "throw without workers", 10, 3, true);
+
+    if (failures) return 1;
+    printf("thread_pool_test: ok\n");
+    return 0;
+}